@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "config.h"
+#include "packet.h"
+
+#define MAX_RUNS 100
+// shortest timed run, iterations are scaled up until a run takes this long
+#define MIN_RUN_NS 5000000.0
+
+// packet sizes to measure, from a bare ICMP header up to a jumbo frame
+static const int sizes[] = {8, 64, 128, 256, 512, 1024, 1500, 4096, 9000};
+
+// keeps the compiler from dropping the benchmarked calls
+static volatile unsigned int sink;
+
+static char packet[9000 + 60];
+static char reply_packet[9000 + 60];
+static char payload[9000];
+
+struct kernel
+{
+    const char *name;
+    void (*run)(int size, long iterations);
+};
+
+static void run_checksum(int size, long iterations)
+{
+    unsigned int sum = 0;
+    for (long i = 0; i < iterations; i++)
+        sum += calculate_checksum(packet, size);
+    sink = sum;
+}
+
+static void run_build(int size, long iterations)
+{
+    unsigned int sum = 0;
+    int payload_size = size - sizeof(struct icmphdr);
+    for (long i = 0; i < iterations; i++)
+        sum += build_echo(packet, 1234, i, payload, payload_size);
+    sink = sum;
+}
+
+// the send path of ping and the MTU sweep: the payload stays in place, only the header is written
+static void run_stamp(int size, long iterations)
+{
+    unsigned int sum = 0;
+    int payload_size = size - sizeof(struct icmphdr);
+    for (long i = 0; i < iterations; i++)
+        sum += stamp_echo(packet, 1234, i, payload_size);
+    sink = sum;
+}
+
+static void run_parse(int size, long iterations)
+{
+    unsigned int sum = 0;
+    struct reply reply;
+    int len = sizeof(struct iphdr) + size;
+    for (long i = 0; i < iterations; i++)
+    {
+        parse_reply(reply_packet, len, NULL, &reply);
+        sum += reply.seq + reply.data_len;
+    }
+    sink = sum;
+}
+
+static const struct kernel kernels[] = {
+    {"checksum", run_checksum},
+    {"build", run_build},
+    {"stamp", run_stamp},
+    {"parse", run_parse},
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Opens a user-space instruction counter, or returns -1 if perf is unavailable.
+static int open_counter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Fills the buffers with an echo request and a matching reply of the given ICMP size.
+static void prepare(int size)
+{
+    int payload_size = size - sizeof(struct icmphdr);
+    build_echo(packet, 1234, 1, payload, payload_size);
+    struct iphdr *ip_header = (struct iphdr *)reply_packet;
+    memset(ip_header, 0, sizeof(*ip_header));
+    ip_header->version = 4;
+    ip_header->ihl = sizeof(*ip_header) / 4;
+    ip_header->ttl = 64;
+    ip_header->protocol = IPPROTO_ICMP;
+    ip_header->tot_len = htons(sizeof(*ip_header) + size);
+    ip_header->saddr = inet_addr("192.0.2.1");
+    ip_header->daddr = inet_addr("192.0.2.2");
+    memcpy(reply_packet + sizeof(*ip_header), packet, size);
+    ((struct icmphdr *)(reply_packet + sizeof(*ip_header)))->type = ICMP_ECHOREPLY;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int runs = 15;
+    int warmup = 3;
+    const char *only = NULL;
+    while ((opt = getopt(argc, argv, "r:w:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'k':
+            only = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s (-r <runs>) (-w <warmup-runs>) (-k checksum|build|stamp|parse)\n", argv[0]);
+            return 1;
+        }
+    }
+    if (runs < 1 || runs > MAX_RUNS || warmup < 0)
+    {
+        fprintf(stderr, "Error: runs must be between 1 and %d\n", MAX_RUNS);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = 'A' + i % 26;
+    int counter = open_counter();
+    if (counter < 0)
+        fprintf(stderr, "perf counters unavailable, insn/byte not reported\n");
+    printf("%-9s %6s %10s %10s %10s %8s %10s\n", "kernel", "bytes", "ns/op", "min", "stddev", "GB/s", "insn/byte");
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+    {
+        if (only != NULL && strcmp(only, kernels[k].name) != 0)
+            continue;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            int size = sizes[s];
+            prepare(size);
+            // warm up caches and find an iteration count long enough to time
+            long iterations = 1;
+            for (int w = 0; w < warmup || w == 0; w++)
+            {
+                double start = now_ns();
+                kernels[k].run(size, iterations);
+                while (now_ns() - start < MIN_RUN_NS)
+                {
+                    iterations *= 2;
+                    start = now_ns();
+                    kernels[k].run(size, iterations);
+                }
+            }
+            double samples[MAX_RUNS];
+            double sum = 0;
+            if (counter >= 0)
+            {
+                ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+                ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+            }
+            for (int r = 0; r < runs; r++)
+            {
+                double start = now_ns();
+                kernels[k].run(size, iterations);
+                samples[r] = (now_ns() - start) / iterations;
+                sum += samples[r];
+            }
+            uint64_t instructions = 0;
+            if (counter >= 0)
+            {
+                ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(counter, &instructions, sizeof(instructions)) != sizeof(instructions))
+                    instructions = 0;
+            }
+            double mean = sum / runs, variance = 0;
+            for (int r = 0; r < runs; r++)
+                variance += (samples[r] - mean) * (samples[r] - mean);
+            qsort(samples, runs, sizeof(samples[0]), compare_double);
+            double median = samples[runs / 2];
+            printf("%-9s %6d %10.2f %10.2f %10.2f %8.2f", kernels[k].name, size, median, samples[0],
+                   sqrt(variance / runs), size / median);
+            if (instructions > 0)
+                printf(" %10.2f\n", (double)instructions / ((double)iterations * runs * size));
+            else
+                printf(" %10s\n", "n/a");
+        }
+    }
+    if (counter >= 0)
+        close(counter);
+    return 0;
+}
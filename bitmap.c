@@ -0,0 +1,78 @@
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bitmap.h"
+
+int bitmap_open(struct bitmap *map, const char *path, uint32_t network, int prefix_len, uint64_t count, uint64_t hash)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("fstat(2)");
+        close(fd);
+        return -1;
+    }
+    size_t size = sizeof(struct bitmap_header) + BITMAP_WORDS(count) * sizeof(uint64_t);
+    int existing = st.st_size > 0;
+    if (existing && (size_t)st.st_size != size)
+    {
+        fprintf(stderr, "Error: \"%s\" holds a different prefix\n", path);
+        close(fd);
+        return -1;
+    }
+    if (!existing && ftruncate(fd, size) < 0)
+    {
+        perror("ftruncate(2)");
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap(2)");
+        return -1;
+    }
+    map->header = data;
+    map->bits = (uint64_t *)(map->header + 1);
+    map->size = size;
+    if (!existing)
+    {
+        // the file was just zero filled, so every host starts out dead
+        map->header->magic = BITMAP_MAGIC;
+        map->header->version = BITMAP_VERSION;
+        map->header->network = network;
+        map->header->prefix_len = prefix_len;
+        map->header->count = count;
+        map->header->hash = hash;
+        return 0;
+    }
+    if (map->header->magic != BITMAP_MAGIC || map->header->version != BITMAP_VERSION ||
+        map->header->network != network || map->header->prefix_len != (uint32_t)prefix_len ||
+        map->header->count != count || map->header->hash != hash)
+    {
+        // a target list of the same size and start would otherwise take the bits of other hosts
+        fprintf(stderr, "Error: \"%s\" holds a different prefix or target list\n", path);
+        bitmap_close(map);
+        return -1;
+    }
+    return map->header->timestamp != 0;
+}
+
+void bitmap_close(struct bitmap *map)
+{
+    if (map->header == NULL)
+        return;
+    msync(map->header, map->size, MS_SYNC);
+    munmap(map->header, map->size);
+    map->header = NULL;
+}
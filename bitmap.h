@@ -0,0 +1,41 @@
+#ifndef _BITMAP_H
+#define _BITMAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BITMAP_MAGIC 0x50414d4c // "LMAP" on disk
+#define BITMAP_VERSION 2
+
+// On-disk header, followed by one bit per address of the prefix, or per target of a target list.
+struct bitmap_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t network;    // first address (host order), for IPv6 the 32 bit words of the prefix xored
+    uint32_t prefix_len; // 0 for a target list
+    uint64_t count;      // addresses covered
+    int64_t timestamp;   // end of the last scan, 0 if never scanned
+    uint64_t generation; // scans so far
+    uint64_t hash;       // of the normalized targets and exclusions, see ranges_hash
+};
+
+// Liveness bitmap memory-mapped from a file.
+struct bitmap
+{
+    struct bitmap_header *header;
+    uint64_t *bits;
+    size_t size;
+};
+
+#define BITMAP_TEST(bits, i) (((bits)[(i) / 64] >> ((i) % 64)) & 1)
+#define BITMAP_SET(bits, i) ((bits)[(i) / 64] |= (uint64_t)1 << ((i) % 64))
+// Number of 64 bit words needed for count addresses.
+#define BITMAP_WORDS(count) (((count) + 63) / 64)
+
+// Opens the store at path, creating it for the prefix if missing. Returns 1 if it held an earlier
+// scan of the same prefix and targets, 0 if it is new, -1 with a message on stderr otherwise.
+int bitmap_open(struct bitmap *map, const char *path, uint32_t network, int prefix_len, uint64_t count, uint64_t hash);
+// Flushes the store to disk and unmaps it.
+void bitmap_close(struct bitmap *map);
+#endif
@@ -1,11 +1,41 @@
 #ifndef _PING_H
 #define _PING_H
 
-#define TIMEOUT 10
+#define RTO_INITIAL 1000
+#define RTO_MIN 10
+#define RTO_MAX 3000
+#define RTO_SUBNET_BITS 8 // timeouts are learned per /24, or /120 for IPv6
 #define BUFFER_SIZE 1024
+#define JUMBO_SIZE 9216
 #define SLEEP_TIME 1
 #define MAX_REQUESTS 0
 #define MAX_RETRY 3
 #define MAX_HOPS 30
+#define TRACE_PROBES 3 // probes per hop
+#define FLOOD_BURST 256
+#define SWEEP_BURST 4096
+#define ARP_BATCH 64
+#define NEIGH_PACE_MS 10 // a rate limited neighbour sweep sends what this many ms allow per batch
+#define MAX_LINKS 16
+#define MAX_PATHS 16
+#define V6_DENSE_BITS 16
+#define V6_SPARSE_BITS 8
+#define DAEMON_SOCKET "/run/probed.sock"
+#define DAEMON_MAX_CLIENTS 64
+#define DAEMON_MAX_JOBS 256
+#define DAEMON_MAX_TARGETS 256
+#define DAEMON_MAX_COUNT 100000
+#define DAEMON_MAX_RATE 100000
+#define DAEMON_RATE 10
+#define DAEMON_TTL 64
+#define DAEMON_WINDOW 1024
+#define DAEMON_BURST 256
+#define DAEMON_SLACK 10
+#define DAEMON_LINE 4096
+#define DAEMON_OUTPUT (256 * 1024)
+#define RING_SLOTS 65536
+#define MTU_PROBES 8
+#define MTU_BURST 64
+#define MTU_SCALE_MIN 16
 unsigned short int calculate_checksum(void *data, unsigned int bytes);
 #endif
\ No newline at end of file
@@ -1,3 +1,4 @@
+#define _DEFAULT_SOURCE
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
@@ -8,10 +9,65 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include "config.h"
+#include "packet.h"
+#include "stats.h"
+#include "rto.h"
+#include "bitmap.h"
+#include "targets.h"
+#include "neigh.h"
+#include "path.h"
+
+// Order in which the targets are probed. Hosts are numbered by their rank in the target set.
+struct sweep
+{
+    uint32_t count;
+    const uint64_t *previous; // last scan, NULL if there is none
+    int dead_rate;            // probe one in dead_rate of the 64 host blocks that were all dead
+    uint64_t generation;
+    const struct ranges *excluded; // ranks never to probe
+    int pass;                      // 0: hosts alive last time, 1: the rest
+    uint64_t next;
+    uint64_t skip_first; // next excluded run at or after next
+    uint64_t skip_last;
+};
+
+// Maps host numbers to addresses, IPv4 as ::ffff:a.b.c.d. Addresses grow with the host number.
+// IPv4 hosts are ranks in the merged target set. IPv6 hosts are keys into one prefix, key = /64 << host_bits | id:
+// every address of a small prefix, or only the low interface ids of each /64 of a wide one, which is where
+// statically numbered hosts sit and all a sweep can reach.
+struct space
+{
+    const struct ranges *targets; // IPv4 target set
+    uint64_t prefix_hi;           // IPv6 prefix, upper and lower 64 bits
+    uint64_t prefix_lo;
+    int host_bits;      // bits of a key that select the interface id
+    uint32_t id_offset; // interface id of the first key of each /64
+    uint32_t count;
+    // Writes the address of host.
+    void (*addr)(const struct space *space, uint32_t host, struct in6_addr *addr);
+    // Returns the host with address addr, or -1 if it is no target.
+    int64_t (*host)(const struct space *space, const struct in6_addr *addr);
+    // Returns the number of the subnet of host, a /24 for IPv4, a /120 or /64 for IPv6, counting from 0.
+    uint32_t (*subnet)(const struct space *space, uint32_t host);
+    const struct ranges *subnets; // IPv4: the /24s holding targets
+    int subnet_shift;             // IPv6: bits of a key within its subnet
+    uint32_t num_subnets;
+};
+
+// Hosts found so far and how to report them.
+struct results
+{
+    const struct space *space;
+    const uint64_t *previous; // last scan, NULL if there is none
+    uint64_t *alive;
+    int rescan;
+    uint32_t up;
+};
 
 // Converts the number of 0 bits in a subnet mask to the binary subnet mask.
 uint32_t numToSubnet(int num)
@@ -21,18 +77,313 @@ uint32_t numToSubnet(int num)
     return ~0U << (32 - num);
 }
 
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s (-a <dest-addr> -c <subnet-mask>) (-f <targets-file>) (-x <exclude-file>) (-S <stats-interval>) "
+                    "(-m <min-timeout-ms>) (-M <max-timeout-ms>) (-s <store> (-r (-d <dead-rate>))) (-A)\n"
+                    "(-i <interface>(/<source-addr>)(@<probes-per-sec>))...\n"
+                    "each path sends at its own rate, neighbour sweeps on its interface included\n"
+                    "IPv6 takes -a <prefix> -c <prefix-len> only\n",
+            name);
+}
+
+// Finds the first excluded run at or after the next host.
+static void sweep_seek(struct sweep *sweep)
+{
+    size_t i = ranges_lower_bound(sweep->excluded, sweep->next);
+    if (i == sweep->excluded->count)
+    {
+        sweep->skip_first = sweep->skip_last = UINT64_MAX;
+        return;
+    }
+    sweep->skip_first = sweep->excluded->items[i].first;
+    sweep->skip_last = sweep->excluded->items[i].last;
+}
+
+// Sets index to the next host to probe, returns 0 once every host was handed out.
+// Hosts alive in the last scan come first, then the rest, skipping most dead blocks.
+// Excluded runs are stepped over whole.
+static int sweep_next(struct sweep *sweep, uint32_t *index)
+{
+    for (; sweep->pass < 2; sweep->pass++, sweep->next = 0, sweep_seek(sweep))
+    {
+        while (sweep->next < sweep->count)
+        {
+            if (sweep->next > sweep->skip_last)
+                sweep_seek(sweep);
+            if (sweep->next >= sweep->skip_first)
+            {
+                sweep->next = sweep->skip_last + 1;
+                continue;
+            }
+            uint32_t host = sweep->next++;
+            if (sweep->previous == NULL)
+            {
+                if (sweep->pass == 0)
+                {
+                    sweep->next = sweep->count;
+                    continue;
+                }
+                *index = host;
+                return 1;
+            }
+            uint32_t block = host / 64;
+            int was_alive = BITMAP_TEST(sweep->previous, host);
+            if (sweep->previous[block] == 0 &&
+                (sweep->pass == 0 || (sweep->dead_rate > 1 && (block + sweep->generation) % sweep->dead_rate != 0)))
+            {
+                // nothing alive here, or a dead block whose turn has not come
+                sweep->next = (uint64_t)(block + 1) * 64;
+                continue;
+            }
+            if (was_alive == (sweep->pass == 0))
+            {
+                *index = host;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void space_addr4(const struct space *space, uint32_t host, struct in6_addr *addr)
+{
+    addr_map_v4(addr, htonl(ranges_addr(space->targets, host)));
+}
+
+static int64_t space_host4(const struct space *space, const struct in6_addr *addr)
+{
+    return ranges_rank(space->targets, ntohl(addr_v4(addr)));
+}
+
+static uint32_t space_subnet4(const struct space *space, uint32_t host)
+{
+    return ranges_rank(space->subnets, ranges_addr(space->targets, host) >> RTO_SUBNET_BITS);
+}
+
+static uint64_t load64(const uint8_t *bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = value << 8 | bytes[i];
+    return value;
+}
+
+static void store64(uint8_t *bytes, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--, value >>= 8)
+        bytes[i] = value;
+}
+
+static void space_addr6(const struct space *space, uint32_t host, struct in6_addr *addr)
+{
+    store64(addr->s6_addr, space->prefix_hi | host >> space->host_bits);
+    store64(addr->s6_addr + 8, space->prefix_lo | ((host & ((1U << space->host_bits) - 1)) + space->id_offset));
+}
+
+static uint32_t space_subnet6(const struct space *space, uint32_t host)
+{
+    return host >> space->subnet_shift;
+}
+
+static int64_t space_host6(const struct space *space, const struct in6_addr *addr)
+{
+    // out of the prefix either part wraps or overflows its field
+    uint64_t subnet = load64(addr->s6_addr) - space->prefix_hi;
+    uint64_t id = load64(addr->s6_addr + 8) - space->prefix_lo - space->id_offset;
+    if (id >> space->host_bits != 0 || subnet >= space->count >> space->host_bits)
+        return -1;
+    return subnet << space->host_bits | id;
+}
+
+// Returns the first host whose address is after addr, or at it unless after is set. O(log n).
+static uint32_t space_search(const struct space *space, const struct in6_addr *addr, int after)
+{
+    uint32_t low = 0, high = space->count;
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+        struct in6_addr mid_addr;
+        space->addr(space, mid, &mid_addr);
+        int cmp = memcmp(&mid_addr, addr, sizeof(mid_addr));
+        if (cmp < 0 || (after && cmp == 0))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Records a host that answered and prints it, with the interface its reply came in by if via is set,
+// on a rescan only if it came up. Returns 0 if it was seen already.
+static int found(struct results *results, uint32_t host, const char *via)
+{
+    if (BITMAP_TEST(results->alive, host))
+        return 0;
+    BITMAP_SET(results->alive, host);
+    struct in6_addr host_addr;
+    char text[INET6_ADDRSTRLEN];
+    results->space->addr(results->space, host, &host_addr);
+    addr_ntop(&host_addr, text);
+    if (!results->rescan)
+        printf("%s", text);
+    else if (results->previous == NULL || !BITMAP_TEST(results->previous, host))
+    {
+        printf("+ %s", text);
+        results->up++;
+    }
+    else
+        return 1;
+    if (via != NULL)
+        printf(" via %s", via);
+    printf("\n");
+    return 1;
+}
+
+// Takes the pending neighbour replies from hosts in probe.
+static void neigh_collect(const struct resolver *resolver, int sock, const struct link *link, const struct ranges *probe,
+                          struct results *results)
+{
+    struct in6_addr addrs[ARP_BATCH];
+    int count;
+    while ((count = resolver->recv(sock, link, addrs, ARP_BATCH)) >= 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int64_t host = results->space->host(results->space, &addrs[i]);
+            if (host < 0 || ranges_rank(probe, host) < 0)
+                continue;
+            found(results, host, NULL);
+        }
+    }
+}
+
+// Waits until the rate lets the next cost ms worth of requests go, collecting replies meanwhile, and books them.
+// Returns 0, -1 on error.
+static int neigh_pace(const struct resolver *resolver, int sock, const struct link *link, const struct ranges *probe,
+                      struct results *results, double *next_send, double cost)
+{
+    struct pollfd fds[1] = {{sock, POLLIN, 0}};
+    while (1)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        double now_ms = now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+        if (now_ms >= *next_send)
+        {
+            // time spent idle earns no burst
+            *next_send = (*next_send > now_ms - 1 ? *next_send : now_ms) + cost;
+            return 0;
+        }
+        int ret = stats_poll(fds, 1, (int)(*next_send - now_ms) + 1);
+        if (ret < 0)
+        {
+            perror("poll(2)");
+            return -1;
+        }
+        if (ret > 0)
+            neigh_collect(resolver, sock, link, probe, results);
+    }
+}
+
+// Asks for the hosts of probe, all on the prefix of link, with ARP or NDP in batches, then waits timeout ms for the
+// last replies. Neighbours answer whether or not they filter ICMP. interval is the ms between requests of the path
+// on the link, 0 for no limit, and batches shrink to what it allows every few ms. Returns the number of requests,
+// -1 on error.
+static int neigh_sweep(const struct resolver *resolver, const struct link *link, const struct ranges *probe,
+                       struct results *results, int timeout, double interval)
+{
+    int sock = resolver->open(link);
+    if (sock < 0)
+        return -1;
+    stats_setup_socket(sock, probe->size < SWEEP_BURST ? probe->size : SWEEP_BURST, NEIGH_PACKET_LEN);
+    struct in6_addr batch[ARP_BATCH];
+    int count = 0, sent = 0;
+    int batch_max = interval > 0 && NEIGH_PACE_MS / interval < ARP_BATCH ? (int)(NEIGH_PACE_MS / interval) : ARP_BATCH;
+    if (batch_max < 1)
+        batch_max = 1;
+    double next_send = 0;
+    for (size_t i = 0; i < probe->count; i++)
+    {
+        for (uint64_t host = probe->items[i].first; host <= probe->items[i].last; host++)
+        {
+            struct in6_addr *addr = &batch[count];
+            results->space->addr(results->space, host, addr);
+            // the first and last address of a prefix are no hosts, and we do not answer our own requests
+            if (memcmp(addr, &link->first, sizeof(*addr)) == 0 || memcmp(addr, &link->last, sizeof(*addr)) == 0)
+                continue;
+            if (memcmp(addr, &link->addr, sizeof(*addr)) == 0)
+            {
+                found(results, host, NULL);
+                continue;
+            }
+            if (++count < batch_max)
+                continue;
+            if (interval > 0 && neigh_pace(resolver, sock, link, probe, results, &next_send, count * interval) < 0)
+            {
+                close(sock);
+                return -1;
+            }
+            sent += resolver->send(sock, link, batch, count);
+            count = 0;
+            // drain between batches so replies do not overflow the socket
+            neigh_collect(resolver, sock, link, probe, results);
+        }
+    }
+    if (count > 0 && interval > 0 && neigh_pace(resolver, sock, link, probe, results, &next_send, count * interval) < 0)
+    {
+        close(sock);
+        return -1;
+    }
+    if (count > 0)
+        sent += resolver->send(sock, link, batch, count);
+    struct pollfd fds[1] = {{sock, POLLIN, 0}};
+    struct timeval start, now;
+    gettimeofday(&start, NULL);
+    while (1)
+    {
+        gettimeofday(&now, NULL);
+        int remaining = timeout - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000);
+        if (remaining <= 0)
+            break;
+        int ret = stats_poll(fds, 1, remaining);
+        if (ret < 0)
+        {
+            perror("poll(2)");
+            close(sock);
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        neigh_collect(resolver, sock, link, probe, results);
+    }
+    close(sock);
+    return sent;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 5)
+    if (argc < 3)
     {
-        fprintf(stderr, "Usage: %s -a <dest-addr> -c <subnet-mask>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
     char opt;
     char *dest_addr = NULL;
     int subnet_no = -1;
+    int stats_interval = -1;
+    int rto_min = RTO_MIN, rto_max = RTO_MAX;
+    char *store_path = NULL;
+    int rescan = 0;
+    int dead_rate = 1;
+    int use_neigh = 1;
+    // interfaces and sources to probe by, parsed once the family is known
+    char *path_specs[MAX_PATHS];
+    int num_of_paths = 0;
+    // targets and addresses never to probe
+    struct ranges targets = {NULL, 0, 0, 0}, exclude = {NULL, 0, 0, 0}, excluded = {NULL, 0, 0, 0};
     // find address
-    while ((opt = getopt(argc, argv, "a:c:")) >= 0)
+    while ((opt = getopt(argc, argv, "a:c:f:x:S:m:M:s:rd:Ai:")) >= 0)
     {
         switch (opt)
         {
@@ -42,118 +393,480 @@ int main(int argc, char *argv[])
         case 'c':
             subnet_no = atoi(optarg);
             break;
+        case 'f':
+            // the network and broadcast addresses of its prefixes are not hosts
+            if (ranges_load(&targets, optarg, &exclude) < 0)
+                return 1;
+            break;
+        case 'x':
+            if (ranges_load(&exclude, optarg, NULL) < 0)
+                return 1;
+            break;
+        case 'S':
+            stats_interval = atoi(optarg);
+            break;
+        case 'm':
+            rto_min = atoi(optarg);
+            break;
+        case 'M':
+            rto_max = atoi(optarg);
+            break;
+        case 's':
+            store_path = optarg;
+            break;
+        case 'r':
+            rescan = 1;
+            break;
+        case 'd':
+            dead_rate = atoi(optarg);
+            break;
+        case 'A':
+            use_neigh = 0;
+            break;
+        case 'i':
+            if (num_of_paths == MAX_PATHS)
+            {
+                fprintf(stderr, "Error: at most %d paths\n", MAX_PATHS);
+                return 1;
+            }
+            path_specs[num_of_paths++] = optarg;
+            break;
         default:
-            fprintf(stderr, "Usage: %s -a <dest-addr> -c <subnet-mask>\n", argv[0]);
+            usage(argv[0]);
             return 1;
         }
     }
-    if (dest_addr == NULL || subnet_no == -1)
+    if ((dest_addr == NULL) != (subnet_no == -1) || (dest_addr == NULL && targets.count == 0) || rto_min <= 0 || rto_max < rto_min ||
+        (rescan && store_path == NULL) || dead_rate < 1 || (dead_rate > 1 && !rescan))
     {
-        fprintf(stderr, "Usage: %s -a <dest-addr> -c <subnet-mask>\n", argv[0]);
+        usage(argv[0]);
         return 1;
     }
-    // initialize destination address
-    struct sockaddr_in destination_address;
-    // set up subnet mask
-    uint32_t subnet_mask;
-    if ((subnet_mask = numToSubnet(subnet_no)) == 0)
+    // the address family of the targets picks the packet format, the host numbering and the neighbour protocol
+    const struct family *family = &family_v4;
+    struct ranges subnets = {NULL, 0, 0, 0};
+    struct space space = {&targets, 0, 0, 0, 0, 0, space_addr4, space_host4, space_subnet4, &subnets, 0, 0};
+    struct in6_addr prefix;
+    uint32_t store_network = 0;
+    uint64_t store_hash = RANGES_HASH_INIT;
+    int sparse = 0;
+    if (dest_addr != NULL && inet_pton(AF_INET6, dest_addr, &prefix) == 1)
     {
-        fprintf(stderr, "Error: \"%d\" is not a valid subnet mask\n", subnet_no);
-        return 1;
+        family = &family_v6;
+        if (targets.count > 0 || exclude.count > 0)
+        {
+            fprintf(stderr, "Error: target and exclude files hold IPv4 addresses only\n");
+            return 1;
+        }
+        if (subnet_no < 0 || subnet_no > 128)
+        {
+            fprintf(stderr, "Error: \"%d\" is not a valid prefix length\n", subnet_no);
+            return 1;
+        }
+        // a wide prefix gets the low ids of each of its /64s
+        int subnet_bits = subnet_no < 64 ? 64 - subnet_no : 0;
+        sparse = 128 - subnet_no > V6_DENSE_BITS;
+        space.host_bits = sparse ? V6_SPARSE_BITS : 128 - subnet_no;
+        if (subnet_bits + space.host_bits >= 32)
+        {
+            fprintf(stderr, "Error: too many targets\n");
+            return 1;
+        }
+        space.prefix_hi = load64(prefix.s6_addr) & (subnet_no >= 64 ? UINT64_MAX : ~(UINT64_MAX >> subnet_no));
+        space.prefix_lo = load64(prefix.s6_addr + 8) & (subnet_no <= 64 ? 0 : ~(UINT64_MAX >> (subnet_no - 64)));
+        space.id_offset = sparse;
+        space.count = 1U << (subnet_bits + space.host_bits);
+        space.addr = space_addr6;
+        space.host = space_host6;
+        // timeouts are learned per /120 of a small prefix, per /64 of a wide one
+        space.subnet = space_subnet6;
+        space.subnet_shift = sparse ? space.host_bits : RTO_SUBNET_BITS;
+        space.num_subnets = (space.count >> space.subnet_shift) + 1;
+        // a dense prefix starts with the subnet-router anycast address, sparse ids start after it
+        if (!sparse && space.count > 1 && ranges_add(&excluded, 0, 0) < 0)
+        {
+            perror("malloc(3)");
+            return 1;
+        }
+        ranges_normalize(&excluded);
+        // stores tell prefixes apart by a fold of the address
+        store_network = (space.prefix_hi >> 32) ^ space.prefix_hi ^ (space.prefix_lo >> 32) ^ space.prefix_lo;
+        store_hash = ranges_hash_value(ranges_hash_value(store_hash, space.prefix_hi), space.prefix_lo);
+    }
+    else
+    {
+        if (dest_addr != NULL)
+        {
+            // set up subnet mask
+            uint32_t subnet_mask;
+            if ((subnet_mask = numToSubnet(subnet_no)) == 0)
+            {
+                fprintf(stderr, "Error: \"%d\" is not a valid subnet mask\n", subnet_no);
+                return 1;
+            }
+            // find address range, all but the network and broadcast addresses, which a /31 or /32 does not have
+            uint32_t network_addr = ntohl(inet_addr(dest_addr) & ntohl(subnet_mask));
+            uint32_t broadcast_addr = network_addr + (uint32_t)(((uint64_t)1 << (32 - subnet_no)) - 1);
+            if (ranges_add(&targets, network_addr, broadcast_addr) < 0 ||
+                (subnet_no <= 30 && (ranges_add(&exclude, network_addr, network_addr) < 0 ||
+                                     ranges_add(&exclude, broadcast_addr, broadcast_addr) < 0)))
+            {
+                perror("malloc(3)");
+                return 1;
+            }
+        }
+        // merge overlapping targets and number them
+        ranges_normalize(&targets);
+        ranges_normalize(&exclude);
+        if (targets.size >= UINT32_MAX)
+        {
+            fprintf(stderr, "Error: too many targets\n");
+            return 1;
+        }
+        if (ranges_to_ranks(&targets, &exclude, &excluded) < 0)
+        {
+            perror("malloc(3)");
+            return 1;
+        }
+        space.count = targets.size;
+        store_network = targets.items[0].first;
+        store_hash = ranges_hash(&exclude, ranges_hash(&targets, store_hash));
+        for (size_t i = 0; i < targets.count; i++)
+        {
+            if (ranges_add(&subnets, targets.items[i].first >> RTO_SUBNET_BITS, targets.items[i].last >> RTO_SUBNET_BITS) < 0)
+            {
+                perror("malloc(3)");
+                return 1;
+            }
+        }
+        ranges_normalize(&subnets);
+        space.num_subnets = subnets.size;
     }
-    // find address range
-    int num_of_addr = 1 << (32 - subnet_no);
-    in_addr_t addr_range[num_of_addr];
-    memset(&addr_range, 0, sizeof(addr_range));
-    uint32_t network_addr = ntohl(inet_addr(dest_addr) & ntohl(subnet_mask));
-    for (int i = 1; i < num_of_addr; i++)
-        addr_range[i] = htonl(network_addr + i);
+    uint32_t num_of_addr = space.count;
+    // open results of earlier scans, a target list is stored with prefix length 0
+    struct bitmap store = {NULL, NULL, 0};
+    int have_previous = 0;
+    int store_prefix = dest_addr != NULL && targets.count <= 1 ? subnet_no : 0;
+    if (store_path != NULL &&
+        (have_previous = bitmap_open(&store, store_path, store_network, store_prefix, num_of_addr, store_hash)) < 0)
+        return 1;
     // set msg
     char buffer[BUFFER_SIZE] = {0};
     char *msg = "ABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890!@#$^&*()_+{}|:<>?~`-=[]',.";
     int payload_size = strlen(msg) + 1;
-    // create socket
-    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
-    if (sock < 0)
+    // one socket per path, the routing table's choice if none was given
+    struct path paths[MAX_PATHS];
+    int named_paths = num_of_paths;
+    memset(&paths[0], 0, sizeof(paths[0]));
+    for (int i = 0; i < num_of_paths; i++)
+        if (path_parse(&paths[i], path_specs[i], family) < 0)
+            return 1;
+    if (num_of_paths == 0)
+        num_of_paths = 1;
+    for (int i = 0; i < num_of_paths; i++)
+    {
+        // replies to timed out probes may still arrive late
+        if (path_open(&paths[i], family, num_of_addr < SWEEP_BURST ? num_of_addr : SWEEP_BURST) < 0)
+            return 1;
+    }
+    stats_install(stats_interval);
+    // echo id
+    uint16_t id = getpid();
+    // reply timeouts, one per subnet of the targets falling back to the scan wide one until the subnet answers
+    struct rto scan_rto;
+    rto_init(&scan_rto, RTO_INITIAL, rto_min, rto_max);
+    uint32_t num_of_subnets = space.num_subnets;
+    struct rto *subnet_rto = malloc(num_of_subnets * sizeof(struct rto));
+    // hosts seen in this scan, late replies may repeat
+    uint64_t *alive = calloc(BITMAP_WORDS(num_of_addr), sizeof(uint64_t));
+    // the last probes sent, which late replies can still answer
+    struct
     {
-        perror("socket(2)");
-        if (errno == EACCES || errno == EPERM)
-            fprintf(stderr, "You need to run the program with sudo.\n");
+        uint32_t index;
+        struct timeval sent;
+        uint8_t path;
+        uint8_t answered;
+    } *probes = malloc(SWEEP_BURST * sizeof(*probes));
+    if (subnet_rto == NULL || alive == NULL || probes == NULL)
+    {
+        perror("malloc(3)");
         return 1;
     }
-    // create ICMP header
-    struct icmphdr icmp_header;
-    icmp_header.type = ICMP_ECHO;
-    icmp_header.code = 0;
-    icmp_header.un.echo.id = htons(getpid());
-    // packet seq
-    int seq = 0;
-    // create poll structure
-    struct pollfd fds[1];
-    fds[0].fd = sock;
-    fds[0].events = POLLIN;
+    for (uint32_t i = 0; i < num_of_subnets; i++)
+        rto_init(&subnet_rto[i], RTO_INITIAL, rto_min, rto_max);
+    const uint64_t *previous = have_previous ? store.bits : NULL;
+    struct sweep sweep = {num_of_addr, previous, dead_rate, have_previous ? store.header->generation : 0, &excluded, 0, 0, 0, 0};
     // print initial message
-    printf("scanning %s/%d\n", dest_addr, subnet_no);
-    // validate ips in range
-    for (int i = 0; i < num_of_addr; i++)
-    {
-        // set buff and icmp header
-        memset(buffer, 0, sizeof(buffer));
-        icmp_header.un.echo.sequence = htons(seq++);
-        icmp_header.checksum = 0;
-        // add icmp header
-        memcpy(buffer, &icmp_header, sizeof(icmp_header));
-        // add payload after
-        memcpy(buffer + sizeof(icmp_header), msg, payload_size);
-        // calculate checksum
-        int checksum = calculate_checksum(buffer, sizeof(icmp_header) + payload_size);
-        icmp_header.checksum = checksum;
-        struct icmphdr *pckt_hdr = (struct icmphdr *)buffer;
-        pckt_hdr->checksum = icmp_header.checksum;
-        // set destination address
-        memset(&destination_address, 0, sizeof(destination_address));
-        destination_address.sin_family = AF_INET;
-        destination_address.sin_addr.s_addr = addr_range[i];
-        // send packet
-        if (sendto(sock, buffer, (sizeof(icmp_header) + payload_size), 0, (struct sockaddr *)&destination_address, sizeof(destination_address)) <= 0)
-        {
-            perror("sendto(2)");
-            close(sock);
-            return 1;
-        }
-        // wait for reply
-        int ret = poll(fds, 1, 1000);
-        if (ret == 0)
+    if (dest_addr != NULL && targets.count <= 1)
+        printf("%s %s/%d", rescan && have_previous ? "rescanning" : "scanning", dest_addr, subnet_no);
+    else
+        printf("%s %u addresses in %zu ranges, %llu excluded", rescan && have_previous ? "rescanning" : "scanning",
+               num_of_addr, targets.count, (unsigned long long)excluded.size);
+    if (sparse)
+        printf(", interface ids 1-%d of each /64", 1 << V6_SPARSE_BITS);
+    if (rescan && have_previous)
+        printf(", last scan %llds ago", (long long)(time(NULL) - store.header->timestamp));
+    printf("\n");
+    uint32_t sent = 0, down = 0;
+    struct results results = {&space, previous, alive, rescan, 0};
+    // hosts on directly connected prefixes are asked for with ARP or NDP, the rest are routed and get ICMP
+    const struct resolver *resolver = family == &family_v4 ? &resolver_arp : &resolver_ndp;
+    struct ranges skipped = {NULL, 0, 0, 0};
+    for (size_t i = 0; i < excluded.count; i++)
+        ranges_add(&skipped, excluded.items[i].first, excluded.items[i].last);
+    struct link links[MAX_LINKS];
+    int num_of_links = use_neigh ? neigh_links(links, MAX_LINKS, family->domain) : 0;
+    for (int i = 0; i < num_of_links; i++)
+    {
+        // given paths keep the sweep off the other interfaces, and their rate holds for it too
+        struct path *link_path = named_paths > 0 ? path_find(paths, named_paths, links[i].index) : NULL;
+        if (named_paths > 0 && link_path == NULL)
+            continue;
+        // hosts are numbered in address order, so those on the link are one run
+        uint32_t first = space_search(&space, &links[i].first, 0), end = space_search(&space, &links[i].last, 1);
+        struct ranges onlink = {NULL, 0, 0, 0}, probe = {NULL, 0, 0, 0};
+        if (first >= end || ranges_add(&onlink, first, end - 1) < 0)
             continue;
-        else if (ret < 0)
+        ranges_normalize(&onlink);
+        ranges_normalize(&skipped);
+        // a prefix reachable over two links is swept once
+        if (ranges_subtract(&onlink, &skipped, &probe) == 0 && probe.size > 0)
+        {
+            printf("%s on %s for %llu addresses\n", resolver->name, links[i].name, (unsigned long long)probe.size);
+            int ret = neigh_sweep(resolver, &links[i], &probe, &results, rto_max,
+                                  link_path != NULL ? link_path->interval : 0);
+            if (ret >= 0)
+            {
+                sent += ret;
+                for (size_t j = 0; j < probe.count; j++)
+                    ranges_add(&skipped, probe.items[j].first, probe.items[j].last);
+            }
+        }
+        ranges_free(&onlink);
+        ranges_free(&probe);
+    }
+    ranges_normalize(&skipped);
+    sweep.excluded = &skipped;
+    sweep_seek(&sweep);
+    // destination of every probe, only the address changes
+    union sockaddr_any destination_address;
+    memset(&destination_address, 0, sizeof(destination_address));
+    destination_address.sa.sa_family = family->domain;
+    // every path has one probe in flight and sends the next once it is answered or timed out, taking late replies to
+    // earlier probes on the way, so more paths sweep faster. The extra last wait takes the stragglers.
+    struct pollfd fds[MAX_PATHS];
+    for (int i = 0; i < num_of_paths; i++)
+    {
+        fds[i].fd = paths[i].sock;
+        fds[i].events = POLLIN;
+    }
+    int exhausted = 0, draining = 0;
+    double drain_end = 0;
+    while (1)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        double now_ms = now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+        int busy = 0;
+        for (int i = 0; i < num_of_paths; i++)
+        {
+            struct path *path = &paths[i];
+            if (path->busy && now_ms < path->deadline)
+            {
+                busy = 1;
+                continue;
+            }
+            path->busy = 0;
+            uint32_t index;
+            if ((exhausted && !path->retry) || now_ms < path->next_send)
+                continue;
+            if (path->retry)
+                index = path->retry_index;
+            else if (!sweep_next(&sweep, &index))
+            {
+                exhausted = 1;
+                continue;
+            }
+            // build echo request, the seq is the probe number
+            int packet_len = family_build_echo(family, buffer, id, sent, msg, payload_size);
+            // set destination address
+            struct in6_addr target;
+            space.addr(&space, index, &target);
+            family_set_addr(family, &destination_address, &target);
+            // send packet
+            if (stats_sendto(path->sock, buffer, packet_len, &destination_address.sa, family->addr_len) <= 0)
+            {
+                // a full queue keeps the host for the next turn of the path, a ms later at the soonest
+                if (errno == EAGAIN || errno == ENOBUFS)
+                {
+                    path->retry = 1;
+                    path->retry_index = index;
+                    path->next_send = now_ms + (path->interval > 1 ? path->interval : 1);
+                    continue;
+                }
+                // a host the kernel will not send to, a broadcast address or one without a route, is a failed
+                // probe, counted in the send errors
+                if (errno == EACCES || errno == EHOSTUNREACH || errno == ENETUNREACH)
+                {
+                    path->retry = 0;
+                    path->next_send = now_ms + path->interval;
+                    continue;
+                }
+                perror("sendto(2)");
+                return 1;
+            }
+            probes[sent % SWEEP_BURST].index = index;
+            probes[sent % SWEEP_BURST].sent = now;
+            probes[sent % SWEEP_BURST].path = i;
+            probes[sent % SWEEP_BURST].answered = 0;
+            struct rto *rto = &subnet_rto[space.subnet(&space, index)];
+            path->deadline = now_ms + rto_timeout(rto->srtt > 0 ? rto : &scan_rto);
+            path->next_send = now_ms + path->interval;
+            path->retry = 0;
+            path->probe = sent++;
+            path->sent++;
+            path->busy = busy = 1;
+        }
+        for (int i = 0; i < num_of_paths; i++)
+            busy |= paths[i].retry;
+        if (exhausted && !busy)
+        {
+            if (!draining)
+            {
+                draining = 1;
+                drain_end = now_ms + rto_timeout(&scan_rto);
+            }
+            else if (now_ms >= drain_end)
+                break;
+        }
+        // sleep until a path times out or may send again
+        double wake = draining ? drain_end : now_ms + rto_max;
+        for (int i = 0; i < num_of_paths; i++)
+        {
+            if (paths[i].busy && paths[i].deadline < wake)
+                wake = paths[i].deadline;
+            else if (!paths[i].busy && (!exhausted || paths[i].retry) && paths[i].next_send < wake)
+                wake = paths[i].next_send;
+        }
+        int ret = stats_poll(fds, num_of_paths, wake > now_ms ? (int)(wake - now_ms) + 1 : 0);
+        if (ret < 0)
         {
             perror("poll(2)");
-            close(sock);
             return 1;
         }
-        // initialize destination address
-        struct sockaddr_in source_address;
-        if (fds[0].revents & POLLIN)
+        for (int i = 0; i < num_of_paths; i++)
         {
-            // get source
-            memset(&source_address, 0, sizeof(source_address));
-            memset(buffer, 0, sizeof(buffer));
-            if (recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_address, &(socklen_t){sizeof(source_address)}) <= 0)
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            while (1)
             {
-                perror("recvfrom(2)");
-                close(sock);
-                return 1;
+                // initialize source address
+                union sockaddr_any source_address;
+                memset(&source_address, 0, sizeof(source_address));
+                int ifindex;
+                int len = stats_recvfrom_if(paths[i].sock, buffer, sizeof(buffer), &source_address.sa,
+                                            &(socklen_t){sizeof(source_address)}, &ifindex);
+                if (len < 0 && errno == EAGAIN)
+                    break;
+                if (len <= 0)
+                {
+                    perror("recvfrom(2)");
+                    return 1;
+                }
+                gettimeofday(&now, NULL);
+                struct reply reply;
+                if (family_parse_reply(family, buffer, len, &source_address.sa, &reply) < 0)
+                {
+                    STATS_INC(malformed);
+                    continue;
+                }
+                // find which probe it answers: the seq holds the low bits of the probe number
+                uint32_t age = (uint16_t)(sent - 1 - reply.seq);
+                uint32_t probe = sent - 1 - age;
+                int64_t host = space.host(&space, &reply.target);
+                if (!match_reply(&reply, id, MATCH_DISCOVERY) || age >= sent || age >= SWEEP_BURST ||
+                    host < 0 || probes[probe % SWEEP_BURST].index != host || probes[probe % SWEEP_BURST].answered)
+                {
+                    STATS_INC(filtered[reply.type]);
+                    continue;
+                }
+                probes[probe % SWEEP_BURST].answered = 1;
+                // the path that sent it is free again
+                struct path *sender = &paths[probes[probe % SWEEP_BURST].path];
+                if (sender->busy && sender->probe == probe)
+                    sender->busy = 0;
+                // replies are credited to the interface they came in by, which need not be the one the probe left by.
+                // The socket that got it is taken first, paths sharing an interface differ only in their source.
+                struct path *ingress = &paths[i];
+                if (ingress->index != ifindex && (ingress = path_find(paths, num_of_paths, ifindex)) == NULL)
+                    ingress = &paths[i];
+                if (!found(&results, host, ingress->name[0] != '\0' ? ingress->name : NULL))
+                    continue;
+                struct timeval *probe_sent = &probes[probe % SWEEP_BURST].sent;
+                stats_latency(probe_sent, &now);
+                double rtt = (now.tv_sec - probe_sent->tv_sec) * 1000.0 + (now.tv_usec - probe_sent->tv_usec) / 1000.0;
+                rto_sample(&scan_rto, rtt);
+                rto_sample(&subnet_rto[space.subnet(&space, host)], rtt);
+                ingress->received++;
+                ingress->rtt_sum += rtt;
             }
-            // print destination address
-            struct iphdr *ip_header = (struct iphdr *)buffer;
-            struct icmphdr *icmp_header = (struct icmphdr *)(buffer + ip_header->ihl * 4);
-            if (icmp_header->type == ICMP_ECHOREPLY)
-                printf("%s\n", inet_ntoa(destination_address.sin_addr));
         }
-        else
-            fprintf(stderr, "Error: packet received with type %d\n", icmp_header.type);
     }
-    close(sock);
+    for (int i = 0; i < num_of_paths; i++)
+        close(paths[i].sock);
+    // excluded hosts were not probed, so they keep their last state
+    if (previous != NULL)
+        for (size_t i = 0; i < excluded.count; i++)
+            for (uint64_t host = excluded.items[i].first; host <= excluded.items[i].last; host++)
+                if (BITMAP_TEST(previous, host))
+                    BITMAP_SET(alive, host);
+    // report hosts that went down, skipped blocks were all dead already
+    if (rescan && previous != NULL)
+    {
+        for (uint32_t block = 0; block < BITMAP_WORDS(num_of_addr); block++)
+        {
+            uint64_t gone = previous[block] & ~alive[block];
+            for (int bit = 0; gone != 0; bit++, gone >>= 1)
+            {
+                if (!(gone & 1))
+                    continue;
+                struct in6_addr host_addr;
+                char text[INET6_ADDRSTRLEN];
+                space.addr(&space, (uint64_t)block * 64 + bit, &host_addr);
+                printf("- %s\n", addr_ntop(&host_addr, text));
+                down++;
+            }
+        }
+    }
+    // save results for the next rescan
+    if (store_path != NULL)
+    {
+        memcpy(store.bits, alive, BITMAP_WORDS(num_of_addr) * sizeof(uint64_t));
+        store.header->timestamp = time(NULL);
+        store.header->generation++;
+        bitmap_close(&store);
+    }
+    free(subnet_rto);
+    ranges_free(&subnets);
+    free(alive);
+    free(probes);
+    ranges_free(&targets);
+    ranges_free(&exclude);
+    ranges_free(&excluded);
+    ranges_free(&skipped);
+    if (rescan)
+        printf("%u up, %u down, %u probes\n", results.up, down, sent);
+    // latency by path, for comparing uplinks
+    for (int i = 0; i < named_paths; i++)
+    {
+        char label[PATH_LABEL_LEN];
+        printf("%s: %u probes, %u replies", path_label(&paths[i], label), paths[i].sent, paths[i].received);
+        if (paths[i].received > 0)
+            printf(", avg rtt %.3fms", paths[i].rtt_sum / paths[i].received);
+        printf("\n");
+    }
     printf("Scan Complete!\n");
+    if (stats_interval >= 0)
+        stats_dump(stderr);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,185 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "config.h"
+#include "mtu.h"
+#include "stats.h"
+
+// Fate of a probe.
+#define SIZE_LOST 0
+#define SIZE_FITS 1
+#define SIZE_TOO_BIG 2
+
+static const char *size_names[] = {"lost", "ok", "too-big"};
+
+// Sends one echo of each size back to back and waits until all are answered or the timeout runs out.
+// Fills status and the rtt of those that fit, lowers mtu to the smallest next-hop mtu reported and sets elapsed to
+// the ms from the first send to the last reply. Returns how many were answered.
+static int probe_sizes(struct prober *prober, const int *sizes, int count, int *status, double *rtts, int *mtu,
+                       double *elapsed)
+{
+    const struct family *family = prober->family;
+    struct timeval sent[MTU_BURST], first, now;
+    uint16_t base = prober->seq;
+    int pending = 0, answered = 0;
+    gettimeofday(&first, NULL);
+    *elapsed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int packet_len = family_stamp_echo(family, prober->request, prober->id, base + i, sizes[i]);
+        gettimeofday(&sent[i], NULL);
+        status[i] = SIZE_LOST;
+        if (stats_sendto(prober->sock, prober->request, packet_len, &prober->dest->sa, family->addr_len) > 0)
+            pending++;
+        else if (errno == EMSGSIZE)
+        {
+            // larger than our own interface
+            status[i] = SIZE_TOO_BIG;
+            answered++;
+        }
+    }
+    prober->seq += count;
+    struct pollfd fds[1] = {{prober->sock, POLLIN, 0}};
+    int timeout = rto_timeout(prober->rto);
+    while (pending > 0)
+    {
+        gettimeofday(&now, NULL);
+        int remaining = timeout - ((now.tv_sec - first.tv_sec) * 1000 + (now.tv_usec - first.tv_usec) / 1000);
+        if (remaining <= 0 || stats_poll(fds, 1, remaining) <= 0)
+            break;
+        union sockaddr_any source_address;
+        memset(&source_address, 0, sizeof(source_address));
+        int len = stats_recvfrom(prober->sock, prober->reply, prober->reply_size, &source_address.sa,
+                                 &(socklen_t){sizeof(source_address)});
+        if (len <= 0)
+            break;
+        gettimeofday(&now, NULL);
+        struct reply reply;
+        if (family_parse_reply(family, prober->reply, len, &source_address.sa, &reply) < 0)
+        {
+            STATS_INC(malformed);
+            continue;
+        }
+        int i = (uint16_t)(reply.seq - base);
+        if (!match_reply(&reply, prober->id, MATCH_ECHO | MATCH_TOO_BIG) || i >= count || status[i] != SIZE_LOST)
+        {
+            STATS_INC(filtered[reply.type]);
+            continue;
+        }
+        pending--;
+        answered++;
+        if (reply.kind == MATCH_TOO_BIG)
+        {
+            status[i] = SIZE_TOO_BIG;
+            if (reply.mtu > 0 && (*mtu == 0 || reply.mtu < *mtu))
+                *mtu = reply.mtu;
+            continue;
+        }
+        status[i] = SIZE_FITS;
+        stats_latency(&sent[i], &now);
+        rtts[i] = (now.tv_sec - sent[i].tv_sec) * 1000.0 + (now.tv_usec - sent[i].tv_usec) / 1000.0;
+        rto_sample(prober->rto, rtts[i]);
+        *elapsed = (now.tv_sec - first.tv_sec) * 1000.0 + (now.tv_usec - first.tv_usec) / 1000.0;
+    }
+    return answered;
+}
+
+int mtu_search(struct prober *prober, int max)
+{
+    int low = 0, high = max, fits = -1, heard = 0, retries = 0;
+    int lost_size = -1, lost_count = 0; // size lost right above the largest fit and in how many rounds running
+    int sizes[MTU_PROBES], status[MTU_PROBES];
+    double rtts[MTU_PROBES];
+    while (low <= high)
+    {
+        // spread the probes over the range, the last one at its top
+        int count = high - low + 1 < MTU_PROBES ? high - low + 1 : MTU_PROBES;
+        for (int i = 0; i < count; i++)
+            sizes[i] = low + (int)((long)(high - low + 1) * (i + 1) / count) - 1;
+        int mtu = 0;
+        double elapsed;
+        int silent = 0;
+        if (probe_sizes(prober, sizes, count, status, rtts, &mtu, &elapsed) == 0)
+        {
+            // silence from a host that never answered says nothing, from one that did it means a black hole
+            rto_backoff(prober->rto);
+            if (++retries < MAX_RETRY)
+                continue;
+            if (!heard)
+                return -1;
+            silent = 1;
+        }
+        heard = 1;
+        retries = 0;
+        printf("%d-%d:", low, high);
+        for (int i = 0; i < count; i++)
+            printf(" %d %s", sizes[i], size_names[status[i]]);
+        if (mtu > 0)
+            printf(" (mtu %d)", mtu);
+        printf("\n");
+        // the range shrinks to above the largest size that fit and below the first one after it that did not,
+        // losses below a fit are taken as plain losses. A size lost right above it may be a plain loss too, so it stays
+        // the top of the range and is probed again, until it was lost MAX_RETRY rounds running or the round was silent.
+        int top = -1;
+        for (int i = 0; i < count; i++)
+            if (status[i] == SIZE_FITS)
+                top = i;
+        if (top >= 0)
+            low = (fits = sizes[top]) + 1;
+        if (top + 1 < count)
+        {
+            int next = sizes[top + 1];
+            int lost = status[top + 1] == SIZE_LOST;
+            lost_count = lost && next == lost_size ? lost_count + 1 : 1;
+            lost_size = lost ? next : -1;
+            high = lost && !silent && lost_count < MAX_RETRY ? next : next - 1;
+        }
+        // a next-hop mtu right at the largest fit ends the search, one under it or under the headers is bogus
+        if (mtu > 0 && mtu - prober->family->overhead < high)
+        {
+            high = mtu - prober->family->overhead;
+            if (high < 0 || high < fits)
+            {
+                fprintf(stderr, "Error: next-hop mtu %d leaves no room for a %d byte payload\n", mtu, fits > 0 ? fits : 0);
+                return -2;
+            }
+        }
+    }
+    return fits;
+}
+
+void mtu_scale(struct prober *prober, int max, int count)
+{
+    int sizes[MTU_BURST], status[MTU_BURST];
+    double rtts[MTU_BURST];
+    printf("%8s %10s %14s %8s\n", "payload", "avg rtt", "throughput", "replies");
+    for (int size = MTU_SCALE_MIN < max ? MTU_SCALE_MIN : max;; size = size * 2 < max ? size * 2 : max)
+    {
+        for (int i = 0; i < count; i++)
+            sizes[i] = size;
+        int mtu = 0;
+        double elapsed;
+        probe_sizes(prober, sizes, count, status, rtts, &mtu, &elapsed);
+        int replies = 0;
+        double rtt_sum = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (status[i] != SIZE_FITS)
+                continue;
+            replies++;
+            rtt_sum += rtts[i];
+        }
+        // echoed bits over the time from the first request to the last reply
+        if (replies > 0 && elapsed > 0)
+            printf("%8d %8.3fms %9.1fMbit/s %5d/%d\n", size, rtt_sum / replies,
+                   replies * (double)(size + prober->family->overhead) * 8 / elapsed / 1000, replies, count);
+        else
+            printf("%8d %10s %14s %5d/%d\n", size, "-", "-", replies, count);
+        if (size == max)
+            break;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef _MTU_H
+#define _MTU_H
+
+#include "packet.h"
+#include "rto.h"
+
+// What size sweeps probe with. The request buffer holds the largest payload and is filled once, each probe only
+// stamps its header in front of as much of it as its size needs.
+struct prober
+{
+    int sock; // raw socket with DF set
+    const struct family *family;
+    const union sockaddr_any *dest;
+    uint16_t id;
+    uint16_t seq; // next echo seq
+    struct rto *rto;
+    char *request; // from echo_alloc
+    char *reply;   // receive buffer of reply_size bytes
+    int reply_size;
+};
+
+// Finds the largest payload up to max that reaches the destination unfragmented, probing MTU_PROBES sizes of the
+// remaining range at once. Returns it, -1 if the destination never answered, -2 if a next-hop mtu was too small
+// for the sizes that fit or the headers.
+int mtu_search(struct prober *prober, int max);
+// Sends bursts of count echoes with payloads doubling up to max and prints rtt and throughput for each size.
+void mtu_scale(struct prober *prober, int max, int count);
+#endif
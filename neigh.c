@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <linux/if_packet.h>
+#include <net/if_arp.h>
+#include <netinet/icmp6.h>
+#include <netinet/if_ether.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "config.h"
+#include "neigh.h"
+#include "packet.h"
+#include "stats.h"
+
+// neighbour solicitation followed by a source link-layer address option
+#define NS_LEN (sizeof(struct nd_neighbor_solicit) + 8)
+
+int neigh_links(struct link *links, int max, int domain)
+{
+    struct ifaddrs *ifaddrs;
+    if (getifaddrs(&ifaddrs) < 0)
+    {
+        perror("getifaddrs(3)");
+        return -1;
+    }
+    // used only to look up hardware addresses
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        perror("socket(2)");
+        freeifaddrs(ifaddrs);
+        return -1;
+    }
+    int count = 0;
+    for (struct ifaddrs *ifa = ifaddrs; ifa != NULL && count < max; ifa = ifa->ifa_next)
+    {
+        if (ifa->ifa_addr == NULL || ifa->ifa_netmask == NULL || ifa->ifa_addr->sa_family != domain)
+            continue;
+        if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & (IFF_LOOPBACK | IFF_POINTOPOINT | IFF_NOARP)))
+            continue;
+        struct link *link = &links[count];
+        // both families as 16 byte address and mask
+        unsigned char mask[16];
+        if (domain == AF_INET)
+        {
+            addr_map_v4(&link->addr, ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr);
+            memset(mask, 0xff, 12);
+            memcpy(mask + 12, &((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr, 4);
+        }
+        else
+        {
+            link->addr = ((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+            if (IN6_IS_ADDR_LINKLOCAL(&link->addr))
+                continue;
+            memcpy(mask, ((struct sockaddr_in6 *)ifa->ifa_netmask)->sin6_addr.s6_addr, 16);
+        }
+        // /31 and /32, /127 and /128 have no neighbours worth sweeping
+        if (mask[15] >= 0xfe)
+            continue;
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifa->ifa_name);
+        if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0 || ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER)
+            continue;
+        snprintf(link->name, sizeof(link->name), "%s", ifa->ifa_name);
+        link->index = if_nametoindex(ifa->ifa_name);
+        for (int i = 0; i < 16; i++)
+        {
+            link->first.s6_addr[i] = link->addr.s6_addr[i] & mask[i];
+            link->last.s6_addr[i] = link->addr.s6_addr[i] | (unsigned char)~mask[i];
+        }
+        memcpy(link->mac, ifr.ifr_hwaddr.sa_data, sizeof(link->mac));
+        if (link->index > 0)
+            count++;
+    }
+    close(sock);
+    freeifaddrs(ifaddrs);
+    return count;
+}
+
+// Sends the prepared messages and counts them. Returns how many were sent.
+static int send_batch(int sock, struct mmsghdr *msgs, int count)
+{
+    int sent = 0;
+    while (sent < count)
+    {
+        int ret = sendmmsg(sock, msgs + sent, count - sent, 0);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+    thread_stats->sent += sent;
+    if (sent < count)
+        thread_stats->send_errors += count - sent;
+    return sent;
+}
+
+// Reads up to max pending packets of up to size bytes each into buffers. Returns how many were read, -1 if none.
+static int recv_batch(int sock, unsigned char *buffers, int size, struct mmsghdr *msgs, struct iovec *iov, int max)
+{
+    memset(msgs, 0, max * sizeof(*msgs));
+    for (int i = 0; i < max; i++)
+    {
+        iov[i].iov_base = buffers + i * size;
+        iov[i].iov_len = size;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int ret = recvmmsg(sock, msgs, max, MSG_DONTWAIT, NULL);
+    if (ret <= 0)
+        return -1;
+    thread_stats->received += ret;
+    return ret;
+}
+
+static int arp_open(const struct link *link)
+{
+    // datagram packet sockets let the kernel build the Ethernet header
+    int sock = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ARP));
+    if (sock < 0)
+    {
+        perror("socket(2)");
+        if (errno == EACCES || errno == EPERM)
+            fprintf(stderr, "You need to run the program with sudo.\n");
+        return -1;
+    }
+    struct sockaddr_ll local;
+    memset(&local, 0, sizeof(local));
+    local.sll_family = AF_PACKET;
+    local.sll_protocol = htons(ETH_P_ARP);
+    local.sll_ifindex = link->index;
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0)
+    {
+        perror("bind(2)");
+        close(sock);
+        return -1;
+    }
+#ifdef PACKET_IGNORE_OUTGOING
+    // our own requests would otherwise be read back
+    setsockopt(sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &(int){1}, sizeof(int));
+#endif
+    return sock;
+}
+
+static int arp_send(int sock, const struct link *link, const struct in6_addr *addrs, int count)
+{
+    struct ether_arp requests[ARP_BATCH];
+    struct iovec iov[ARP_BATCH];
+    struct mmsghdr msgs[ARP_BATCH];
+    struct sockaddr_ll broadcast;
+    memset(&broadcast, 0, sizeof(broadcast));
+    broadcast.sll_family = AF_PACKET;
+    broadcast.sll_protocol = htons(ETH_P_ARP);
+    broadcast.sll_ifindex = link->index;
+    broadcast.sll_halen = ETH_ALEN;
+    memset(broadcast.sll_addr, 0xff, ETH_ALEN);
+    uint32_t spa = addr_v4(&link->addr);
+    if (count > ARP_BATCH)
+        count = ARP_BATCH;
+    memset(msgs, 0, count * sizeof(*msgs));
+    for (int i = 0; i < count; i++)
+    {
+        struct ether_arp *request = &requests[i];
+        request->arp_hrd = htons(ARPHRD_ETHER);
+        request->arp_pro = htons(ETHERTYPE_IP);
+        request->arp_hln = ETH_ALEN;
+        request->arp_pln = sizeof(spa);
+        request->arp_op = htons(ARPOP_REQUEST);
+        memcpy(request->arp_sha, link->mac, ETH_ALEN);
+        memcpy(request->arp_spa, &spa, sizeof(spa));
+        memset(request->arp_tha, 0, ETH_ALEN);
+        uint32_t tpa = addr_v4(&addrs[i]);
+        memcpy(request->arp_tpa, &tpa, sizeof(tpa));
+        iov[i].iov_base = request;
+        iov[i].iov_len = sizeof(*request);
+        msgs[i].msg_hdr.msg_name = &broadcast;
+        msgs[i].msg_hdr.msg_namelen = sizeof(broadcast);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return send_batch(sock, msgs, count);
+}
+
+static int arp_recv(int sock, const struct link *link, struct in6_addr *addrs, int max)
+{
+    struct ether_arp replies[ARP_BATCH];
+    struct iovec iov[ARP_BATCH];
+    struct mmsghdr msgs[ARP_BATCH];
+    if (max > ARP_BATCH)
+        max = ARP_BATCH;
+    int ret = recv_batch(sock, (unsigned char *)replies, sizeof(*replies), msgs, iov, max);
+    uint32_t spa = addr_v4(&link->addr);
+    int count = 0;
+    for (int i = 0; i < ret; i++)
+    {
+        const struct ether_arp *reply = &replies[i];
+        // requests from other hosts and, on older kernels, our own come in too
+        if (msgs[i].msg_len < sizeof(*reply) || reply->arp_op != htons(ARPOP_REPLY) ||
+            reply->arp_pro != htons(ETHERTYPE_IP) || memcmp(reply->arp_tpa, &spa, sizeof(spa)) != 0)
+            continue;
+        uint32_t sender;
+        memcpy(&sender, reply->arp_spa, sizeof(sender));
+        addr_map_v4(&addrs[count++], sender);
+    }
+    return ret < 0 ? -1 : count;
+}
+
+static int ndp_open(const struct link *link)
+{
+    int sock = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
+    if (sock < 0)
+    {
+        perror("socket(2)");
+        if (errno == EACCES || errno == EPERM)
+            fprintf(stderr, "You need to run the program with sudo.\n");
+        return -1;
+    }
+    // neighbour discovery is only valid with hop limit 255, and advertisements are all we want back
+    int hops = 255;
+    struct icmp6_filter filter;
+    ICMP6_FILTER_SETBLOCKALL(&filter);
+    ICMP6_FILTER_SETPASS(ND_NEIGHBOR_ADVERT, &filter);
+    struct sockaddr_in6 local;
+    memset(&local, 0, sizeof(local));
+    local.sin6_family = AF_INET6;
+    local.sin6_addr = link->addr;
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops)) < 0 ||
+        setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &link->index, sizeof(link->index)) < 0 ||
+        setsockopt(sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) < 0 ||
+        bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0)
+    {
+        perror("setsockopt(2)");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int ndp_send(int sock, const struct link *link, const struct in6_addr *addrs, int count)
+{
+    unsigned char requests[ARP_BATCH][NS_LEN];
+    struct sockaddr_in6 destinations[ARP_BATCH];
+    struct iovec iov[ARP_BATCH];
+    struct mmsghdr msgs[ARP_BATCH];
+    if (count > ARP_BATCH)
+        count = ARP_BATCH;
+    memset(msgs, 0, count * sizeof(*msgs));
+    memset(destinations, 0, count * sizeof(*destinations));
+    for (int i = 0; i < count; i++)
+    {
+        // the kernel fills in the checksum
+        struct nd_neighbor_solicit solicit;
+        memset(&solicit, 0, sizeof(solicit));
+        solicit.nd_ns_type = ND_NEIGHBOR_SOLICIT;
+        solicit.nd_ns_target = addrs[i];
+        memcpy(requests[i], &solicit, sizeof(solicit));
+        // source link-layer address option, its length in units of 8 bytes
+        unsigned char *option = requests[i] + sizeof(solicit);
+        option[0] = ND_OPT_SOURCE_LINKADDR;
+        option[1] = 1;
+        memcpy(option + 2, link->mac, ETH_ALEN);
+        // solicited-node multicast group of the target, ff02::1:ffxx:xxxx
+        struct sockaddr_in6 *destination = &destinations[i];
+        destination->sin6_family = AF_INET6;
+        destination->sin6_scope_id = link->index;
+        destination->sin6_addr.s6_addr[0] = 0xff;
+        destination->sin6_addr.s6_addr[1] = 0x02;
+        destination->sin6_addr.s6_addr[11] = 0x01;
+        destination->sin6_addr.s6_addr[12] = 0xff;
+        memcpy(destination->sin6_addr.s6_addr + 13, addrs[i].s6_addr + 13, 3);
+        iov[i].iov_base = requests[i];
+        iov[i].iov_len = NS_LEN;
+        msgs[i].msg_hdr.msg_name = destination;
+        msgs[i].msg_hdr.msg_namelen = sizeof(*destination);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return send_batch(sock, msgs, count);
+}
+
+static int ndp_recv(int sock, const struct link *link, struct in6_addr *addrs, int max)
+{
+    (void)link;
+    unsigned char replies[ARP_BATCH][NEIGH_PACKET_LEN];
+    struct iovec iov[ARP_BATCH];
+    struct mmsghdr msgs[ARP_BATCH];
+    if (max > ARP_BATCH)
+        max = ARP_BATCH;
+    int ret = recv_batch(sock, replies[0], NEIGH_PACKET_LEN, msgs, iov, max);
+    int count = 0;
+    for (int i = 0; i < ret; i++)
+    {
+        struct nd_neighbor_advert advert;
+        if (msgs[i].msg_len < sizeof(advert))
+            continue;
+        memcpy(&advert, replies[i], sizeof(advert));
+        // unsolicited advertisements announce changes, they do not answer us
+        if (advert.nd_na_type != ND_NEIGHBOR_ADVERT || !(advert.nd_na_flags_reserved & ND_NA_FLAG_SOLICITED))
+            continue;
+        addrs[count++] = advert.nd_na_target;
+    }
+    return ret < 0 ? -1 : count;
+}
+
+const struct resolver resolver_arp = {"arp", arp_open, arp_send, arp_recv};
+const struct resolver resolver_ndp = {"ndp", ndp_open, ndp_send, ndp_recv};
@@ -0,0 +1,41 @@
+#ifndef _NEIGH_H
+#define _NEIGH_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdint.h>
+
+// room for any request or reply of ARP or NDP, options included
+#define NEIGH_PACKET_LEN 64
+
+// Directly connected Ethernet prefix of a local interface. Addresses are IPv6, IPv4 as ::ffff:a.b.c.d.
+struct link
+{
+    char name[IF_NAMESIZE];
+    int index;
+    struct in6_addr addr;  // our address on the link
+    struct in6_addr first; // first and last address of the prefix
+    struct in6_addr last;
+    unsigned char mac[6];
+};
+
+// Neighbour discovery of one family, ARP for IPv4 and NDP for IPv6. Neighbours answer it even when they filter ICMP.
+struct resolver
+{
+    const char *name;
+    // Opens a socket for the link. Returns it, or -1 with a message on stderr.
+    int (*open)(const struct link *link);
+    // Asks for each of the count addresses in one batch. Returns how many requests were sent.
+    int (*send)(int sock, const struct link *link, const struct in6_addr *addrs, int count);
+    // Reads up to max pending packets without blocking and stores the addresses that answered.
+    // Returns how many did, -1 once nothing is pending.
+    int (*recv)(int sock, const struct link *link, struct in6_addr *addrs, int max);
+};
+
+extern const struct resolver resolver_arp;
+extern const struct resolver resolver_ndp;
+
+// Fills links with up to max on-link prefixes of the domain, AF_INET or AF_INET6. IPv6 link-local prefixes are left out.
+// Returns how many were found, -1 on error.
+int neigh_links(struct link *links, int max, int domain);
+#endif
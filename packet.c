@@ -0,0 +1,224 @@
+#define _DEFAULT_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/icmp6.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "packet.h"
+
+const struct family family_v4 = {AF_INET, IPPROTO_ICMP, 4, IPPROTO_IP, IP_TTL, sizeof(struct sockaddr_in),
+                                 IPPROTO_IP, IP_MTU_DISCOVER, IP_PMTUDISC_PROBE, sizeof(struct iphdr) + ECHO_HEADER_LEN};
+const struct family family_v6 = {AF_INET6, IPPROTO_ICMPV6, 6, IPPROTO_IPV6, IPV6_UNICAST_HOPS, sizeof(struct sockaddr_in6),
+                                 IPPROTO_IPV6, IPV6_MTU_DISCOVER, IPV6_PMTUDISC_PROBE, sizeof(struct ip6_hdr) + ECHO_HEADER_LEN};
+
+int build_echo(char *buffer, uint16_t id, uint16_t seq, const char *payload, int payload_size)
+{
+    // add payload after
+    memcpy(buffer + sizeof(struct icmphdr), payload, payload_size);
+    return stamp_echo(buffer, id, seq, payload_size);
+}
+
+int stamp_echo(char *buffer, uint16_t id, uint16_t seq, int payload_size)
+{
+    struct icmphdr *icmp_header = (struct icmphdr *)buffer;
+    icmp_header->type = ICMP_ECHO;
+    icmp_header->code = 0;
+    icmp_header->checksum = 0;
+    icmp_header->un.echo.id = htons(id);
+    icmp_header->un.echo.sequence = htons(seq);
+    int len = sizeof(*icmp_header) + payload_size;
+    icmp_header->checksum = calculate_checksum(buffer, len);
+    return len;
+}
+
+int parse_reply(const char *buffer, int len, const struct sockaddr *from, struct reply *reply)
+{
+    (void)from;
+    const struct iphdr *ip_header = (const struct iphdr *)buffer;
+    if (len < (int)sizeof(struct iphdr))
+        return -1;
+    int ip_len = ip_header->ihl * 4;
+    if (ip_header->version != 4 || ip_len < (int)sizeof(struct iphdr) ||
+        len < ip_len + (int)sizeof(struct icmphdr))
+        return -1;
+    // only the first fragment carries the icmp header
+    if (ip_header->protocol != IPPROTO_ICMP || (ntohs(ip_header->frag_off) & 0x1fff) != 0)
+        return -1;
+    const struct icmphdr *icmp_header = (const struct icmphdr *)(buffer + ip_len);
+    reply->type = icmp_header->type;
+    reply->code = icmp_header->code;
+    reply->ttl = ip_header->ttl;
+    addr_map_v4(&reply->src, ip_header->saddr);
+    reply->data_len = len - ip_len - sizeof(struct icmphdr);
+    reply->mtu = 0;
+    switch (icmp_header->type)
+    {
+    case ICMP_ECHOREPLY:
+        reply->kind = MATCH_ECHO;
+        break;
+    case ICMP_ECHO:
+        reply->kind = MATCH_REQUEST;
+        break;
+    case ICMP_TIME_EXCEEDED:
+        reply->kind = MATCH_TIME_EXCEEDED;
+        break;
+    case ICMP_DEST_UNREACH:
+        reply->kind = icmp_header->code == ICMP_FRAG_NEEDED ? MATCH_TOO_BIG : MATCH_UNREACH;
+        if (icmp_header->code == ICMP_FRAG_NEEDED)
+            reply->mtu = ntohs(icmp_header->un.frag.mtu);
+        break;
+    default:
+        reply->kind = 0;
+    }
+    if (icmp_header->type != ICMP_TIME_EXCEEDED && icmp_header->type != ICMP_DEST_UNREACH)
+    {
+        reply->id = ntohs(icmp_header->un.echo.id);
+        reply->seq = ntohs(icmp_header->un.echo.sequence);
+        reply->target = reply->src;
+        return 0;
+    }
+    // errors quote the ip header and first 8 bytes of the original probe
+    const char *quoted = buffer + ip_len + sizeof(struct icmphdr);
+    int quoted_len = len - ip_len - sizeof(struct icmphdr);
+    const struct iphdr *inner_ip = (const struct iphdr *)quoted;
+    if (quoted_len < (int)sizeof(struct iphdr))
+        return -1;
+    int inner_len = inner_ip->ihl * 4;
+    if (inner_len < (int)sizeof(struct iphdr) || quoted_len < inner_len + (int)sizeof(struct icmphdr) ||
+        inner_ip->protocol != IPPROTO_ICMP)
+        return -1;
+    const struct icmphdr *inner_icmp = (const struct icmphdr *)(quoted + inner_len);
+    reply->id = ntohs(inner_icmp->un.echo.id);
+    reply->seq = ntohs(inner_icmp->un.echo.sequence);
+    addr_map_v4(&reply->target, inner_ip->daddr);
+    return 0;
+}
+
+int build_echo6(char *buffer, uint16_t id, uint16_t seq, const char *payload, int payload_size)
+{
+    memcpy(buffer + sizeof(struct icmp6_hdr), payload, payload_size);
+    return stamp_echo6(buffer, id, seq, payload_size);
+}
+
+int stamp_echo6(char *buffer, uint16_t id, uint16_t seq, int payload_size)
+{
+    struct icmp6_hdr *icmp_header = (struct icmp6_hdr *)buffer;
+    icmp_header->icmp6_type = ICMP6_ECHO_REQUEST;
+    icmp_header->icmp6_code = 0;
+    // the checksum covers a pseudo header only the kernel knows
+    icmp_header->icmp6_cksum = 0;
+    icmp_header->icmp6_id = htons(id);
+    icmp_header->icmp6_seq = htons(seq);
+    return sizeof(*icmp_header) + payload_size;
+}
+
+int parse_reply6(const char *buffer, int len, const struct sockaddr *from, struct reply *reply)
+{
+    const struct icmp6_hdr *icmp_header = (const struct icmp6_hdr *)buffer;
+    if (len < (int)sizeof(struct icmp6_hdr))
+        return -1;
+    reply->type = icmp_header->icmp6_type;
+    reply->code = icmp_header->icmp6_code;
+    reply->ttl = 0;
+    reply->src = ((const struct sockaddr_in6 *)from)->sin6_addr;
+    reply->data_len = len - sizeof(struct icmp6_hdr);
+    reply->mtu = 0;
+    switch (icmp_header->icmp6_type)
+    {
+    case ICMP6_ECHO_REPLY:
+        reply->kind = MATCH_ECHO;
+        break;
+    case ICMP6_ECHO_REQUEST:
+        reply->kind = MATCH_REQUEST;
+        break;
+    case ICMP6_TIME_EXCEEDED:
+        reply->kind = MATCH_TIME_EXCEEDED;
+        break;
+    case ICMP6_DST_UNREACH:
+        reply->kind = MATCH_UNREACH;
+        break;
+    case ICMP6_PACKET_TOO_BIG:
+        reply->kind = MATCH_TOO_BIG;
+        reply->mtu = ntohl(icmp_header->icmp6_mtu);
+        break;
+    default:
+        reply->kind = 0;
+    }
+    if (icmp_header->icmp6_type != ICMP6_TIME_EXCEEDED && icmp_header->icmp6_type != ICMP6_DST_UNREACH &&
+        icmp_header->icmp6_type != ICMP6_PACKET_TOO_BIG)
+    {
+        reply->id = ntohs(icmp_header->icmp6_id);
+        reply->seq = ntohs(icmp_header->icmp6_seq);
+        reply->target = reply->src;
+        return 0;
+    }
+    // errors quote as much of the original probe as fits, our probes carry no extension headers
+    const char *quoted = buffer + sizeof(struct icmp6_hdr);
+    int quoted_len = len - sizeof(struct icmp6_hdr);
+    const struct ip6_hdr *inner_ip = (const struct ip6_hdr *)quoted;
+    if (quoted_len < (int)(sizeof(struct ip6_hdr) + sizeof(struct icmp6_hdr)) || inner_ip->ip6_nxt != IPPROTO_ICMPV6)
+        return -1;
+    const struct icmp6_hdr *inner_icmp = (const struct icmp6_hdr *)(quoted + sizeof(struct ip6_hdr));
+    reply->id = ntohs(inner_icmp->icmp6_id);
+    reply->seq = ntohs(inner_icmp->icmp6_seq);
+    reply->target = inner_ip->ip6_dst;
+    return 0;
+}
+
+int match_reply(const struct reply *reply, int id, int accept)
+{
+    if (id >= 0 && reply->id != id)
+        return 0;
+    return (reply->kind & accept) != 0;
+}
+
+char *echo_alloc(const char *pattern, int pattern_len, int payload_size)
+{
+    char *buffer = malloc(ECHO_HEADER_LEN + payload_size);
+    if (buffer == NULL)
+        return NULL;
+    for (int i = 0; i < payload_size; i++)
+        buffer[ECHO_HEADER_LEN + i] = pattern[i % pattern_len];
+    return buffer;
+}
+
+const struct family *family_parse(const char *text, union sockaddr_any *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    if (inet_pton(AF_INET, text, &addr->v4.sin_addr) == 1)
+    {
+        addr->v4.sin_family = AF_INET;
+        return &family_v4;
+    }
+    if (inet_pton(AF_INET6, text, &addr->v6.sin6_addr) == 1)
+    {
+        addr->v6.sin6_family = AF_INET6;
+        return &family_v6;
+    }
+    return NULL;
+}
+
+const char *addr_ntop(const struct in6_addr *addr, char *buf)
+{
+    if (IN6_IS_ADDR_V4MAPPED(addr))
+        return inet_ntop(AF_INET, addr->s6_addr + 12, buf, INET6_ADDRSTRLEN);
+    return inet_ntop(AF_INET6, addr, buf, INET6_ADDRSTRLEN);
+}
+
+uint32_t addr_v4(const struct in6_addr *addr)
+{
+    uint32_t v4;
+    memcpy(&v4, addr->s6_addr + 12, sizeof(v4));
+    return v4;
+}
+
+void addr_map_v4(struct in6_addr *out, uint32_t addr)
+{
+    memset(out->s6_addr, 0, 10);
+    out->s6_addr[10] = out->s6_addr[11] = 0xff;
+    memcpy(out->s6_addr + 12, &addr, sizeof(addr));
+}
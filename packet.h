@@ -0,0 +1,123 @@
+#ifndef _PACKET_H
+#define _PACKET_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Fields decoded from a received ICMP or ICMPv6 packet.
+struct reply
+{
+    uint8_t type;
+    uint8_t code;
+    uint8_t kind;           // MATCH_* kind of the reply, 0 if it is of no kind a tool accepts
+    uint8_t ttl;            // ttl of an IPv4 reply, 0 for IPv6 where the header is not delivered
+    uint16_t id;            // echo id, taken from the quoted request for error messages (host order)
+    uint16_t seq;           // echo sequence (host order)
+    struct in6_addr src;    // address of the responder, IPv4 as ::ffff:a.b.c.d
+    struct in6_addr target; // address the original probe was sent to, same form
+    int data_len;           // bytes following the ICMP header
+    int mtu;                // next-hop mtu of a packet too big error, 0 otherwise
+};
+
+// Reply kinds a tool accepts, combined as a bitmask.
+#define MATCH_ECHO 1
+#define MATCH_TIME_EXCEEDED 2
+#define MATCH_UNREACH 4
+#define MATCH_REQUEST 8 // echo requests, looped back when pinging ourselves
+#define MATCH_TOO_BIG 16 // fragmentation needed with DF set, packet too big for IPv6
+// Reply kinds each tool accepts.
+#define MATCH_PING MATCH_ECHO
+#define MATCH_TRACEROUTE (MATCH_ECHO | MATCH_TIME_EXCEEDED)
+#define MATCH_DISCOVERY MATCH_ECHO
+
+// ICMP and ICMPv6 echo headers are the same size, the payload follows.
+#define ECHO_HEADER_LEN 8
+
+// Socket address of either family.
+union sockaddr_any
+{
+    struct sockaddr sa;
+    struct sockaddr_in v4;
+    struct sockaddr_in6 v6;
+};
+
+// What differs between IPv4 and IPv6. A tool picks one table per run; the per-packet calls are the family_ functions
+// below.
+struct family
+{
+    int domain;   // AF_INET or AF_INET6
+    int protocol; // IPPROTO_ICMP or IPPROTO_ICMPV6
+    int version;  // 4 or 6
+    // setsockopt(2) level and option of the unicast ttl or hop limit
+    int ttl_level;
+    int ttl_option;
+    socklen_t addr_len;
+    // setsockopt(2) level, option and value that set DF and never fragment locally, whatever the cached path mtu
+    int df_level;
+    int df_option;
+    int df_value;
+    int overhead; // bytes of ip and echo header in front of the payload
+};
+
+extern const struct family family_v4;
+extern const struct family family_v6;
+
+// IPv4 versions, raw IPv4 sockets deliver the ip header so from is unused.
+int build_echo(char *buffer, uint16_t id, uint16_t seq, const char *payload, int payload_size);
+int stamp_echo(char *buffer, uint16_t id, uint16_t seq, int payload_size);
+int parse_reply(const char *buffer, int len, const struct sockaddr *from, struct reply *reply);
+// IPv6 versions, raw ICMPv6 sockets deliver the ICMPv6 message alone and the kernel fills in the checksum.
+int build_echo6(char *buffer, uint16_t id, uint16_t seq, const char *payload, int payload_size);
+int stamp_echo6(char *buffer, uint16_t id, uint16_t seq, int payload_size);
+int parse_reply6(const char *buffer, int len, const struct sockaddr *from, struct reply *reply);
+// Returns 1 if the reply answers a probe with echo id (any id if -1) and is of an accepted kind.
+int match_reply(const struct reply *reply, int id, int accept);
+
+// Allocates a buffer for echo requests with up to payload_size bytes of payload, which is filled with pattern
+// repeated. Returns NULL if out of memory.
+char *echo_alloc(const char *pattern, int pattern_len, int payload_size);
+// Parses an address of either family into addr. Returns its family, or NULL if text is no address.
+const struct family *family_parse(const char *text, union sockaddr_any *addr);
+// Formats an address, IPv4-mapped ones as dotted quads. buf must hold INET6_ADDRSTRLEN bytes.
+const char *addr_ntop(const struct in6_addr *addr, char *buf);
+// Returns the IPv4 address held in an IPv4-mapped address (network order).
+uint32_t addr_v4(const struct in6_addr *addr);
+// Stores an IPv4 address (network order) as ::ffff:a.b.c.d.
+void addr_map_v4(struct in6_addr *out, uint32_t addr);
+
+// Per-packet calls, specialized per family. Each tests which table the tool picked, a branch that always goes the
+// same way, and calls that family's function directly, so probe loops make no indirect calls.
+
+// Writes an echo request with the given payload into buffer and returns its length.
+static inline int family_build_echo(const struct family *family, char *buffer, uint16_t id, uint16_t seq,
+                                    const char *payload, int payload_size)
+{
+    return family == &family_v4 ? build_echo(buffer, id, seq, payload, payload_size)
+                                : build_echo6(buffer, id, seq, payload, payload_size);
+}
+
+// Writes the echo header in front of a payload already at buffer + ECHO_HEADER_LEN and returns the length,
+// so a reused buffer costs no copy per probe.
+static inline int family_stamp_echo(const struct family *family, char *buffer, uint16_t id, uint16_t seq, int payload_size)
+{
+    return family == &family_v4 ? stamp_echo(buffer, id, seq, payload_size) : stamp_echo6(buffer, id, seq, payload_size);
+}
+
+// Decodes a packet as received from a raw socket of the family, from is where recvfrom(2) said it came from.
+// Returns 0 on success, -1 if malformed.
+static inline int family_parse_reply(const struct family *family, const char *buffer, int len,
+                                     const struct sockaddr *from, struct reply *reply)
+{
+    return family == &family_v4 ? parse_reply(buffer, len, from, reply) : parse_reply6(buffer, len, from, reply);
+}
+
+// Points a socket address of the family at addr, leaving the other fields alone.
+static inline void family_set_addr(const struct family *family, union sockaddr_any *sockaddr, const struct in6_addr *addr)
+{
+    if (family == &family_v4)
+        sockaddr->v4.sin_addr.s_addr = addr_v4(addr);
+    else
+        sockaddr->v6.sin6_addr = *addr;
+}
+#endif
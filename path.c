@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "config.h"
+#include "path.h"
+#include "stats.h"
+
+int path_parse(struct path *path, const char *spec, const struct family *family)
+{
+    memset(path, 0, sizeof(*path));
+    path->sock = -1;
+    char text[IF_NAMESIZE + INET6_ADDRSTRLEN + 32];
+    if (strlen(spec) >= sizeof(text))
+    {
+        fprintf(stderr, "Error: \"%s\" is not a valid path\n", spec);
+        return -1;
+    }
+    strcpy(text, spec);
+    char *rate = strchr(text, '@');
+    if (rate != NULL)
+    {
+        *rate++ = '\0';
+        char *end;
+        double per_sec = strtod(rate, &end);
+        if (*end != '\0' || end == rate || per_sec <= 0)
+        {
+            fprintf(stderr, "Error: \"%s\" is not a valid rate\n", rate);
+            return -1;
+        }
+        path->interval = 1000 / per_sec;
+    }
+    char *source = strchr(text, '/');
+    if (source != NULL)
+    {
+        *source++ = '\0';
+        if (family_parse(source, &path->source) != family)
+        {
+            fprintf(stderr, "Error: \"%s\" is not a valid IPv%d address\n", source, family->version);
+            return -1;
+        }
+    }
+    if (strlen(text) >= sizeof(path->name) || (path->index = if_nametoindex(text)) == 0)
+    {
+        fprintf(stderr, "Error: \"%s\" is not an interface\n", text);
+        return -1;
+    }
+    strcpy(path->name, text);
+    return 0;
+}
+
+int path_open(struct path *path, const struct family *family, int burst)
+{
+    path->sock = socket(family->domain, SOCK_RAW | SOCK_NONBLOCK, family->protocol);
+    if (path->sock < 0)
+    {
+        perror("socket(2)");
+        if (errno == EACCES || errno == EPERM)
+            fprintf(stderr, "You need to run the program with sudo.\n");
+        return -1;
+    }
+    int on = 1;
+    // a bound socket sends by its interface only and gets only what comes in by it
+    if ((path->name[0] != '\0' && setsockopt(path->sock, SOL_SOCKET, SO_BINDTODEVICE, path->name, strlen(path->name) + 1) < 0) ||
+        (path->source.sa.sa_family != 0 && bind(path->sock, &path->source.sa, family->addr_len) < 0) ||
+        (family == &family_v4 && setsockopt(path->sock, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on)) < 0) ||
+        (family == &family_v6 && setsockopt(path->sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on)) < 0))
+    {
+        perror(path->name[0] != '\0' ? path->name : "setsockopt(2)");
+        close(path->sock);
+        path->sock = -1;
+        return -1;
+    }
+    stats_setup_socket(path->sock, burst, BUFFER_SIZE);
+    return 0;
+}
+
+char *path_label(const struct path *path, char *buf)
+{
+    strcpy(buf, path->name);
+    if (path->source.sa.sa_family == 0)
+        return buf;
+    size_t len = strlen(buf);
+    buf[len++] = '/';
+    const void *addr = path->source.sa.sa_family == AF_INET ? (const void *)&path->source.v4.sin_addr
+                                                            : (const void *)&path->source.v6.sin6_addr;
+    inet_ntop(path->source.sa.sa_family, addr, buf + len, PATH_LABEL_LEN - len);
+    return buf;
+}
+
+struct path *path_find(struct path *paths, int count, int index)
+{
+    for (int i = 0; i < count; i++)
+        if (paths[i].index == index)
+            return &paths[i];
+    return NULL;
+}
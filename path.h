@@ -0,0 +1,39 @@
+#ifndef _PATH_H
+#define _PATH_H
+
+#include <net/if.h>
+#include "packet.h"
+
+#define PATH_LABEL_LEN (IF_NAMESIZE + INET6_ADDRSTRLEN + 1)
+
+// Interface and source address probes leave by. Each has its own socket, so its own send and receive queue,
+// and its own rate. The unnamed path sends wherever the routing table says.
+struct path
+{
+    char name[IF_NAMESIZE]; // "" for no interface
+    int index;
+    union sockaddr_any source; // sa_family 0 if the kernel picks
+    double interval;           // ms between probes, 0 for no limit
+    int sock;
+    // kept by the probe loop
+    int busy;        // a probe is waiting for its reply
+    uint32_t probe;  // number of that probe
+    double deadline; // ms, gettimeofday(2) clock
+    double next_send;
+    int retry; // the send to retry_index failed, it is sent again first
+    uint32_t retry_index;
+    uint32_t sent;
+    uint32_t received; // replies that came in by the interface
+    double rtt_sum;
+};
+
+// Parses "<interface>[/<source-addr>][@<probes-per-sec>]" for the family. Returns 0, or -1 with a message on stderr.
+int path_parse(struct path *path, const char *spec, const struct family *family);
+// Opens the raw socket of the path, bound to its interface and source, reporting the interface of every reply.
+// burst is how many replies it queues. Returns 0, or -1 with a message on stderr.
+int path_open(struct path *path, const struct family *family, int burst);
+// Writes "<interface>[/<source-addr>]" into buf of PATH_LABEL_LEN bytes and returns it.
+char *path_label(const struct path *path, char *buf);
+// Returns the path of interface index, NULL if none.
+struct path *path_find(struct path *paths, int count, int index);
+#endif
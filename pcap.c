@@ -0,0 +1,261 @@
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <net/ethernet.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pcap.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 1
+#define PCAPNG_SPB 3
+#define PCAPNG_EPB 6
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d
+
+// link types we know how to strip
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW_OLD 12
+#define LINKTYPE_RAW_OLD2 14
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+static uint16_t read16(const struct pcap *pcap, const unsigned char *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return pcap->swapped ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t read32(const struct pcap *pcap, const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return pcap->swapped ? __builtin_bswap32(v) : v;
+}
+
+// Ethertype of a raw IP packet, from its version nibble.
+static int ip_version(const unsigned char *packet, int len)
+{
+    if (len < 1)
+        return 0;
+    if (packet[0] >> 4 == 4)
+        return ETHERTYPE_IP;
+    if (packet[0] >> 4 == 6)
+        return ETHERTYPE_IPV6;
+    return 0;
+}
+
+// Skips the link layer header in place and returns the ethertype of what follows.
+static int strip_link(int linktype, const unsigned char **packet, int *len)
+{
+    const unsigned char *p = *packet;
+    int skip, ethertype;
+    switch (linktype)
+    {
+    case LINKTYPE_ETHERNET:
+        skip = 14;
+        if (*len < skip)
+            return 0;
+        ethertype = p[12] << 8 | p[13];
+        // step over 802.1Q and 802.1ad tags
+        while ((ethertype == ETHERTYPE_VLAN || ethertype == 0x88a8) && *len >= skip + 4)
+        {
+            ethertype = p[skip + 2] << 8 | p[skip + 3];
+            skip += 4;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL:
+        skip = 16;
+        if (*len < skip)
+            return 0;
+        ethertype = p[14] << 8 | p[15];
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        skip = 20;
+        if (*len < skip)
+            return 0;
+        ethertype = p[0] << 8 | p[1];
+        break;
+    case LINKTYPE_NULL:
+        skip = 4;
+        if (*len < skip)
+            return 0;
+        ethertype = ip_version(p + skip, *len - skip);
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_RAW_OLD:
+    case LINKTYPE_RAW_OLD2:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        skip = 0;
+        ethertype = ip_version(p, *len);
+        break;
+    default:
+        return 0;
+    }
+    *packet = p + skip;
+    *len -= skip;
+    return ethertype;
+}
+
+int pcap_open(struct pcap *pcap, const char *path)
+{
+    memset(pcap, 0, sizeof(*pcap));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("fstat(2)");
+        close(fd);
+        return -1;
+    }
+    if (st.st_size < 24)
+    {
+        fprintf(stderr, "Error: \"%s\" is too short to be a capture\n", path);
+        close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap(2)");
+        return -1;
+    }
+    // we stream through the file once per pass; advice values are not flags, so each takes its own call
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    madvise(data, st.st_size, MADV_WILLNEED);
+    pcap->data = data;
+    pcap->size = st.st_size;
+    uint32_t magic;
+    memcpy(&magic, pcap->data, sizeof(magic));
+    if (magic == PCAPNG_SHB)
+        pcap->ng = 1;
+    else if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC)
+        pcap->swapped = 0;
+    else if (magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC))
+        pcap->swapped = 1;
+    else
+    {
+        fprintf(stderr, "Error: \"%s\" is not a pcap or pcapng file\n", path);
+        pcap_close(pcap);
+        return -1;
+    }
+    if (!pcap->ng)
+        pcap->linktype = read32(pcap, pcap->data + 20) & 0xffff;
+    pcap_rewind(pcap);
+    return 0;
+}
+
+void pcap_rewind(struct pcap *pcap)
+{
+    pcap->offset = pcap->ng ? 0 : 24;
+    pcap->if_count = 0;
+}
+
+// Reads the next packet record of a classic pcap file.
+static int next_pcap(struct pcap *pcap, const unsigned char **packet, int *len, int *linktype)
+{
+    if (pcap->offset + 16 > pcap->size)
+        return 0;
+    const unsigned char *record = pcap->data + pcap->offset;
+    uint32_t caplen = read32(pcap, record + 8);
+    if (caplen > pcap->size - pcap->offset - 16)
+        return -1;
+    *packet = record + 16;
+    *len = caplen;
+    *linktype = pcap->linktype;
+    pcap->offset += 16 + caplen;
+    return 1;
+}
+
+// Reads blocks of a pcapng file until the next packet block.
+static int next_pcapng(struct pcap *pcap, const unsigned char **packet, int *len, int *linktype)
+{
+    while (pcap->offset + 12 <= pcap->size)
+    {
+        const unsigned char *block = pcap->data + pcap->offset;
+        uint32_t type;
+        memcpy(&type, block, sizeof(type));
+        if (type == PCAPNG_SHB)
+        {
+            // every section sets its own byte order and interfaces
+            uint32_t order;
+            memcpy(&order, block + 8, sizeof(order));
+            if (order == PCAPNG_BYTE_ORDER)
+                pcap->swapped = 0;
+            else if (order == __builtin_bswap32(PCAPNG_BYTE_ORDER))
+                pcap->swapped = 1;
+            else
+                return -1;
+            pcap->if_count = 0;
+        }
+        else
+            type = read32(pcap, block);
+        uint32_t block_len = read32(pcap, block + 4);
+        if (block_len < 12 || block_len % 4 != 0 || block_len > pcap->size - pcap->offset)
+            return -1;
+        pcap->offset += block_len;
+        if (type == PCAPNG_IDB && block_len >= 20)
+        {
+            if (pcap->if_count < PCAP_MAX_INTERFACES)
+                pcap->if_linktype[pcap->if_count] = read16(pcap, block + 8);
+            pcap->if_count++;
+        }
+        else if (type == PCAPNG_EPB && block_len >= 32)
+        {
+            uint32_t interface = read32(pcap, block + 8);
+            uint32_t caplen = read32(pcap, block + 20);
+            // a packet names an interface described earlier in its section
+            if (caplen > block_len - 32 || interface >= (uint32_t)pcap->if_count)
+                return -1;
+            *packet = block + 28;
+            *len = caplen;
+            *linktype = interface < PCAP_MAX_INTERFACES ? pcap->if_linktype[interface] : -1;
+            return 1;
+        }
+        else if (type == PCAPNG_SPB && block_len >= 16)
+        {
+            // simple packets belong to the first interface, which has to be described first
+            if (pcap->if_count == 0)
+                return -1;
+            uint32_t caplen = read32(pcap, block + 8);
+            if (caplen > block_len - 16)
+                caplen = block_len - 16;
+            *packet = block + 12;
+            *len = caplen;
+            *linktype = pcap->if_linktype[0];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int pcap_next(struct pcap *pcap, const unsigned char **packet, int *len, int *ethertype)
+{
+    int linktype;
+    int ret = pcap->ng ? next_pcapng(pcap, packet, len, &linktype) : next_pcap(pcap, packet, len, &linktype);
+    if (ret == 1)
+        *ethertype = strip_link(linktype, packet, len);
+    return ret;
+}
+
+void pcap_close(struct pcap *pcap)
+{
+    if (pcap->data != NULL)
+        munmap((void *)pcap->data, pcap->size);
+    pcap->data = NULL;
+}
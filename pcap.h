@@ -0,0 +1,30 @@
+#ifndef _PCAP_H
+#define _PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCAP_MAX_INTERFACES 16
+
+// Memory-mapped pcap or pcapng capture, read sequentially.
+struct pcap
+{
+    const unsigned char *data;
+    size_t size;
+    size_t offset;
+    int ng;      // pcapng instead of classic pcap
+    int swapped; // file byte order differs from ours
+    int linktype;
+    int if_count; // pcapng interfaces in the current section
+    int if_linktype[PCAP_MAX_INTERFACES];
+};
+
+// Maps the capture at path. Returns 0 on success, -1 with a message on stderr otherwise.
+int pcap_open(struct pcap *pcap, const char *path);
+// Returns the network layer of the next packet in *packet/*len and its ethertype (0 if unknown),
+// 0 at the end of the capture, or -1 if the file is corrupt.
+int pcap_next(struct pcap *pcap, const unsigned char **packet, int *len, int *ethertype);
+// Starts reading from the first packet again.
+void pcap_rewind(struct pcap *pcap);
+void pcap_close(struct pcap *pcap);
+#endif
@@ -11,46 +11,48 @@
 #include <unistd.h>			 // UNIX standard function definitions (getpid, close, sleep)
 #include <stdlib.h>
 #include <getopt.h>
-#include <netinet/icmp6.h>
-#include <netinet/ip6.h>
 #include "config.h" // Header file for the program (calculate_checksum function and some constants)
+#include "packet.h" // Echo request builder, reply parser and address families
+#include "stats.h" // Hot-path counters
+#include "rto.h" // Adaptive reply timeout
+#include "ring.h" // Shared-memory sample ring
+#include "mtu.h" // Path mtu search and size sweeps
 
 int main(int argc, char *argv[])
 {
 	if (argc < 5)
 	{
-		fprintf(stderr, "Usage: %s -a <destination_ip> -t <ip_protocol> (-c <num_of_pings>) (-f)\n", argv[0]);
+		fprintf(stderr, "Usage: %s -a <destination_ip> -t <ip_protocol> (-c <num_of_pings>) (-f) (-S <stats_interval>) (-m <min_timeout_ms>) (-M <max_timeout_ms>) (-R <ring_name>) (-s <payload_size>) (-P)\n"
+			"probes leave by the routing table, -i is only in discovery\n", argv[0]);
 		return 1;
 	}
-	struct sockaddr_in destination_address4;// IPv4 destination address
-	struct sockaddr_in6 destination_address6;// IPv6 destination address
-	char buffer[BUFFER_SIZE] = {0};// Buffer for sending and receiving packets
-	char *msg = "ABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890!@#$^&*()_+{}|:<>?~`-=[]',.";// Payload message
+	union sockaddr_any destination_address;// IPv4 or IPv6 destination address
+	const struct family *family = NULL;// Builder, parser and socket options of the address family
+	char *msg = "ABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890!@#$^&*()_+{}|:<>?~`-=[]',.";// Payload pattern
 	int payload_size = strlen(msg) + 1; // Size of the payload
+	int sized = 0; // payload size given, sent with DF set
+	int mtu_sweep = 0; // search the path mtu and measure rtt and throughput by size
 	int retries = 0;// Counter for retries
-	memset(&destination_address4, 0, sizeof(destination_address4));
-	memset(&destination_address6, 0, sizeof(destination_address6));
 	int seq = 0;
 	int opt;
 	int protocol_type = 0;
 	int count = -1; // amount of pings to set
 	int flood = 0;
+	int stats_interval = -1; // seconds between counter dumps, -1 for none
+	int rto_min = RTO_MIN, rto_max = RTO_MAX; // Reply timeout bounds in ms
 	char *dest_addr = NULL;
+	char *ring_name = NULL; // shared-memory segment the samples are published in
 
 	// Parse command-line arguments
-	while ((opt = getopt(argc, argv, "a:t:c:f")) != -1)
+	while ((opt = getopt(argc, argv, "a:t:c:fS:m:M:R:s:P")) != -1)
 	{
 		switch (opt)
 		{
 		case 'a':
 			dest_addr = optarg;
-			if (inet_pton(AF_INET, dest_addr, &destination_address4.sin_addr) == 1)
-				destination_address4.sin_family = AF_INET; // IPv4
-			else if (inet_pton(AF_INET6, dest_addr, &destination_address6.sin6_addr) == 1)
-				destination_address6.sin6_family = AF_INET6; // IPv6
-			else
+			if ((family = family_parse(dest_addr, &destination_address)) == NULL)
 			{
-				fprintf(stderr, "Error: \"%s\" is not a valid IPv4 address\n", optarg);
+				fprintf(stderr, "Error: \"%s\" is not a valid IPv4 or IPv6 address\n", optarg);
 				return 1;
 			}
 			break;
@@ -72,185 +74,218 @@ int main(int argc, char *argv[])
 		case 'f':
 			flood = 1;
 			break;
+		case 'S':
+			stats_interval = atoi(optarg);
+			break;
+		case 'm':
+			rto_min = atoi(optarg);
+			break;
+		case 'M':
+			rto_max = atoi(optarg);
+			break;
+		case 'R':
+			ring_name = optarg;
+			break;
+		case 's':
+			payload_size = atoi(optarg);
+			sized = 1;
+			break;
+		case 'P':
+			mtu_sweep = 1;
+			break;
 		}
 	}
-	int sock;
+	if (family == NULL || family->version != protocol_type)
+	{
+		fprintf(stderr, "Error: \"%s\" is not a valid IPv%d address\n", dest_addr ? dest_addr : "", protocol_type);
+		return 1;
+	}
+	if (rto_min <= 0 || rto_max < rto_min)
+	{
+		fprintf(stderr, "Invalid timeout bounds\n");
+		return 1;
+	}
+	// Sweep probes are not samples of the path, so they are not published
+	if (mtu_sweep && ring_name != NULL)
+	{
+		fprintf(stderr, "Error: -R does not go with -P\n");
+		return 1;
+	}
+	// Up to jumbo frames, headers included; for a sweep this is the largest size tried
+	if (payload_size < 0 || payload_size > JUMBO_SIZE - family->overhead)
+	{
+		fprintf(stderr, "Invalid payload size, at most %d\n", JUMBO_SIZE - family->overhead);
+		return 1;
+	}
+	if (!sized && mtu_sweep)
+		payload_size = JUMBO_SIZE - family->overhead;
+	// Requests are built once, only their headers change; replies may be as large
+	char *request = echo_alloc(msg, strlen(msg) + 1, payload_size);
+	char *buffer = malloc(JUMBO_SIZE);
+	if (request == NULL || buffer == NULL)
+	{
+		perror("malloc(3)");
+		return 1;
+	}
+	// Reply timeout, learned from the replies to earlier requests
+	struct rto rto;
+	rto_init(&rto, RTO_INITIAL, rto_min, rto_max);
 	int count_sent = count;// Total packets sent
 	int count_received = 0;// Total packets received
 	float total_time = 0, min_time = -1, max_time = 0;
 	struct pollfd fds[1];// File descriptor for poll
-	if (protocol_type == 4)// IPv4 setup
+	stats_install(stats_interval);
+	int sock = socket(family->domain, SOCK_RAW, family->protocol);
+	if (sock < 0)
+	{
+		perror("socket(2)");
+		if (errno == EACCES || errno == EPERM)
+			fprintf(stderr, "you need to run the program with sudo.\n");
+		return 1;
+	}
+	// poll
+	fds[0].fd = sock;
+	fds[0].events = POLLIN;
+	// Room for replies piling up while flooding
+	stats_setup_socket(sock, mtu_sweep ? MTU_BURST : flood ? FLOOD_BURST : 1, family->overhead + payload_size);
+	// Sized packets are not fragmented, a router that cannot pass one says so
+	if ((sized || mtu_sweep) && setsockopt(sock, family->df_level, family->df_option, &family->df_value, sizeof(family->df_value)) < 0)
+	{
+		perror("setsockopt(2)");
+		close(sock);
+		return 1;
+	}
+	uint16_t id = getpid();// Echo identifier for requests
+	struct ring ring;// Every reply and timeout is published here for collectors
+	if (ring_name != NULL && ring_create(&ring, ring_name, RING_SLOTS) < 0)
+	{
+		close(sock);
+		return 1;
+	}
+	struct in6_addr target;// Destination as the samples hold it
+	if (family == &family_v4)
+		addr_map_v4(&target, destination_address.v4.sin_addr.s_addr);
+	else
+		target = destination_address.v6.sin6_addr;
+	int status = 0;
+	if (mtu_sweep)
 	{
-		sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
-		// poll
-		fds[0].fd = sock;
-		fds[0].events = POLLIN;
-		if (sock < 0)
+		struct prober prober = {sock, family, &destination_address, id, 0, &rto, request, buffer, JUMBO_SIZE};
+		fprintf(stdout, "PMTU %s, payloads up to %d bytes:\n", dest_addr, payload_size);
+		int fits = mtu_search(&prober, payload_size);
+		if (fits == -1)
+			fprintf(stderr, "No responses received.\n");
+		else if (fits >= 0)
 		{
-			perror("socket(2)");
-			if (errno == EACCES || errno == EPERM)
-				fprintf(stderr, "you need to run the program with sudo.\n");
-			return 1;
+			fprintf(stdout, "path mtu %d (%d bytes of payload)\n", fits + family->overhead, fits);
+			mtu_scale(&prober, fits, count > 0 && count < MTU_BURST ? count : MTU_BURST);
 		}
-		struct icmphdr icmp_header;// ICMP header for requests
-		icmp_header.type = ICMP_ECHO;
-		icmp_header.code = 0;
-		icmp_header.un.echo.id = htons(getpid());
-		seq = 0;
+		status = fits < 0;
+	}
+	else
+	{
 		fprintf(stdout, "PING %s with %d bytes of data:\n", dest_addr, payload_size);
 		while (1)
 		{
 			if (count == 0)// Stop when count reaches 0
 				break;
-			memset(buffer, 0, sizeof(buffer));// Clear buffer
-			icmp_header.un.echo.sequence = htons(seq++);// Set sequence number
-			icmp_header.checksum = 0; // Reset checksum
-			// Copy ICMP header and payload to buffer
-			memcpy(buffer, &icmp_header, sizeof(icmp_header));
-			memcpy(buffer + sizeof(icmp_header), msg, payload_size);
-			// Calculate checksum and update header
-			icmp_header.checksum = calculate_checksum(buffer, sizeof(icmp_header) + payload_size);
-			struct icmphdr *pckt_hdr = (struct icmphdr *)buffer;
-			pckt_hdr->checksum = icmp_header.checksum;
+			// Stamp the ICMP header in front of the payload
+			int packet_len = family_stamp_echo(family, request, id, seq++, payload_size);
 			struct timeval start, end;
 			gettimeofday(&start, NULL);
 			// Send ICMP packet
-			if (sendto(sock, buffer, (sizeof(icmp_header) + payload_size), 0, (struct sockaddr *)&destination_address4, sizeof(destination_address4)) <= 0)
-			{
-				perror("sendto(2)");
-				close(sock);
-				return 1;
-			}
-			int ret = poll(fds, 1, TIMEOUT);
-			if (ret == 0)
+			if (stats_sendto(sock, request, packet_len, &destination_address.sa, family->addr_len) <= 0)
 			{
-				if (++retries == MAX_RETRY)
+				if (errno != EAGAIN && errno != ENOBUFS)
 				{
-					fprintf(stderr, "Request timeout for icmp_seq %d, aborting.\n", seq);
-					break;
+					perror("sendto(2)");
+					close(sock);
+					return 1;
 				}
-				fprintf(stderr, "Request timeout for icmp_seq %d, retrying...\n", seq);
-				--seq;
+				// Send queue full, counted as lost
+				count--;
 				continue;
 			}
-			else if (ret < 0)
+			// Wait for the reply until the timeout runs out, skipping foreign and late packets
+			int answered = 0;
+			while (!answered)
 			{
-				perror("poll(2)");
-				close(sock);
-				return 1;
-			}
-			if (fds[0].revents & POLLIN)// Packet received
-			{
-				struct sockaddr_in source_address;
-				memset(buffer, 0, sizeof(buffer));
+				gettimeofday(&end, NULL);
+				int remaining = rto_timeout(&rto) - ((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000);
+				int ret = remaining > 0 ? stats_poll(fds, 1, remaining) : 0;
+				if (ret == 0)
+					break;
+				else if (ret < 0)
+				{
+					perror("poll(2)");
+					close(sock);
+					return 1;
+				}
+				if (!(fds[0].revents & POLLIN))
+					continue;
+				union sockaddr_any source_address;// Packet received
 				memset(&source_address, 0, sizeof(source_address));
-				if (recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_address, &(socklen_t){sizeof(source_address)}) <= 0)
+				int len = stats_recvfrom(sock, buffer, JUMBO_SIZE, &source_address.sa, &(socklen_t){sizeof(source_address)});
+				if (len <= 0)
 				{
 					perror("recvfrom(2)");
 					close(sock);
 					return 1;
 				}
-				retries = 0;
 				gettimeofday(&end, NULL);
-				struct iphdr *ip_header = (struct iphdr *)buffer;
-				struct icmphdr *icmp_header = (struct icmphdr *)(buffer + ip_header->ihl * 4);
-				if (icmp_header->type == ICMP_ECHOREPLY)// Echo reply received
+				struct reply reply;
+				if (family_parse_reply(family, buffer, len, &source_address.sa, &reply) < 0)
+				{
+					STATS_INC(malformed);
+					continue;
+				}
+				if (!match_reply(&reply, id, MATCH_PING) || reply.seq != (uint16_t)(seq - 1))
 				{
-					float rtt = ((float)(end.tv_usec - start.tv_usec) / 1000) + ((end.tv_sec - start.tv_sec) * 1000);
-					total_time += rtt;
-					if (min_time == -1 || rtt < min_time)
-					{
-						min_time = rtt;
-					}
-					if (rtt > max_time)
-					{
-						max_time = rtt;
-					}
-					count_received++;
-					fprintf(stdout, "%ld bytes from %s: icmp_seq=%d ttl=%d time=%.2fms\n",
-							(ntohs(ip_header->tot_len) - (ip_header->ihl * 4) - sizeof(struct icmphdr)),
-							inet_ntoa(source_address.sin_addr),
-							ntohs(icmp_header->un.echo.sequence),
-							ip_header->ttl, rtt);
-					//stop after max request
-					if (seq == MAX_REQUESTS)
-						break;
+					STATS_INC(filtered[reply.type]);
+					// Echo requests and late replies are dropped quietly
+					if (reply.kind == MATCH_TOO_BIG && reply.id == id)
+						fprintf(stderr, "Error: packet too big for the path, mtu %d\n", reply.mtu);
+					else if (!(reply.kind & (MATCH_ECHO | MATCH_REQUEST)))
+						fprintf(stderr, "Error: packet received with type %d\n", reply.type);
+					continue;
 				}
+				answered = 1;// Echo reply received
+				stats_latency(&start, &end);
+				float rtt = ((float)(end.tv_usec - start.tv_usec) / 1000) + ((end.tv_sec - start.tv_sec) * 1000);
+				if (retries == 0)// Karn: the rtt of a retried request is ambiguous
+					rto_sample(&rto, rtt);
+				retries = 0;
+				total_time += rtt;
+				if (min_time == -1 || rtt < min_time)
+				{
+					min_time = rtt;
+				}
+				if (rtt > max_time)
+				{
+					max_time = rtt;
+				}
+				count_received++;
+				if (ring_name != NULL)
+				{
+					struct sample sample = {0, target, reply.src, ring_usec(&start), ring_usec(&end), reply.seq, reply.ttl, RING_REPLY, 0};
+					ring_publish(&ring, &sample);
+				}
+				char source_ip[INET6_ADDRSTRLEN];
+				addr_ntop(&reply.src, source_ip);
+				// Raw ICMPv6 sockets do not deliver the hop limit
+				if (reply.ttl > 0)
+					fprintf(stdout, "%d bytes from %s: icmp_seq=%d ttl=%d time=%.2fms\n", reply.data_len, source_ip, reply.seq, reply.ttl, rtt);
 				else
-					fprintf(stderr, "Error: packet received with type %d\n", icmp_header->type);
-			}
-			count--;
-			// Sleep between pings if not flood
-			if (!flood)
-			{
-				sleep(SLEEP_TIME);
-			}
-		}
-	}
-	else if (protocol_type == 6)
-	{
-		sock = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
-		if (sock < 0)//if socket creation failed
-		{
-			perror("socket(2)");
-			if (errno == EACCES || errno == EPERM)// If permission error
-			{
-				fprintf(stderr, "You need to run the program with sudo.\n");
-			}
-			return 1;
-		}
-		struct sockaddr_in6 local_addr;
-		socklen_t addr_len = sizeof(local_addr);
-		// Retrieve local address with the socket
-		if (getsockname(sock, (struct sockaddr *)&local_addr, &addr_len) < 0)
-		{
-			perror("getsockname");
-			close(sock);
-			return 1;
-		}
-		// ip header
-		struct ip6_hdr ip6_header;
-		ip6_header.ip6_dst = destination_address6.sin6_addr;
-		ip6_header.ip6_src = local_addr.sin6_addr;
-		ip6_header.ip6_ctlun.ip6_un1.ip6_un1_nxt = IPPROTO_ICMPV6;
-		// poll
-		fds[0].fd = sock;
-		fds[0].events = POLLIN;
-		// icmp
-		struct icmp6_hdr icmp6_header;
-		icmp6_header.icmp6_type = ICMP6_ECHO_REQUEST;
-		icmp6_header.icmp6_code = 0;
-		icmp6_header.icmp6_id = htons(getpid());
-		seq = 0;
-
-		while (1)
-		{
-			if (count == 0)// if no packets left to send
-				break;
-			// Prepare the ICMPv6 message
-			memcpy(buffer + sizeof(icmp6_header), msg, payload_size);
-			memset(buffer, 0, sizeof(buffer));
-			icmp6_header.icmp6_seq = htons(seq++);
-			icmp6_header.icmp6_cksum = 0;
-			memcpy(buffer, &icmp6_header, sizeof(icmp6_header));
-			memcpy(buffer + sizeof(icmp6_header), msg, payload_size);
-            icmp6_header.icmp6_cksum = calculate_checksum(buffer, sizeof(icmp6_header) + payload_size);
-			struct icmphdr *pckt_hdr = (struct icmphdr *)buffer;
-			pckt_hdr->checksum = icmp6_header.icmp6_cksum;
-			struct timeval start, end;
-			gettimeofday(&start, NULL);
-			// Send the ICMPv6 packet
-			if (sendto(sock, buffer, sizeof(icmp6_header) + payload_size, 0, (struct sockaddr *)&destination_address6, sizeof(destination_address6)) <= 0)
-			{
-				perror("sendto(2)");
-				close(sock);
-				return 1;
+					fprintf(stdout, "%d bytes from %s: icmp_seq=%d time=%.2fms\n", reply.data_len, source_ip, reply.seq, rtt);
 			}
-			fprintf(stdout, "PING %s with %d bytes of data:\n", dest_addr, payload_size);
-			// Wait for a response with a timeout
-			int ret = poll(fds, 1, TIMEOUT);
-			if (ret == 0)// Maximum retries reached
+			if (!answered)
 			{
+				if (ring_name != NULL)
+				{
+					struct sample sample = {0, target, IN6ADDR_ANY_INIT, ring_usec(&start), 0, seq - 1, 0, RING_TIMEOUT, 0};
+					ring_publish(&ring, &sample);
+				}
+				rto_backoff(&rto);
 				if (++retries == MAX_RETRY)
 				{
 					fprintf(stderr, "Request timeout for icmp_seq %d, aborting.\n", seq);
@@ -260,72 +295,30 @@ int main(int argc, char *argv[])
 				--seq;
 				continue;
 			}
-			else if (ret < 0) // Error during poll
-			{
-				perror("poll(2)");
-				close(sock);
-				return 1;
-			}
-			if (fds[0].revents & POLLIN)
-			{
-				struct sockaddr_in6 source_address;
-				memset(buffer, 0, sizeof(buffer));
-				memset(&source_address, 0, sizeof(source_address));
-				// Receive the response
-				if (recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_address, &addr_len) <= 0)
-				{
-					perror("recvfrom(2)");
-					close(sock);
-					return 1;
-				}
-				retries = 0;
-				gettimeofday(&end, NULL);
-				struct ip6_hdr *ip6_header = (struct ip6_hdr *)buffer;
-				struct icmp6_hdr *icmp6_header = (struct icmp6_hdr *)(buffer + sizeof(struct ip6_hdr));
-				// Check echo reply
-				if (icmp6_header->icmp6_type == ICMP6_ECHO_REPLY)
-				{
-					// Calculate rtt
-					float rtt = ((float)(end.tv_usec - start.tv_usec) / 1000) + ((end.tv_sec - start.tv_sec) * 1000);
-					total_time += rtt;
-					if (min_time == -1 || rtt < min_time)
-					{
-						min_time = rtt;
-					}
-					if (rtt > max_time)
-					{
-						max_time = rtt;
-					}
-					count_received++;
-					char source_ip[INET6_ADDRSTRLEN];
-					fprintf(stdout, "%ld bytes from %s: icmp_seq=%d ttl=%d time=%.2fms\n",
-							(ntohs(ip6_header->ip6_plen) + sizeof(struct icmp6_hdr)),
-							inet_ntop(AF_INET6, &source_address.sin6_addr, source_ip, sizeof(source_ip)),
-							ntohs(icmp6_header->icmp6_seq),
-							ip6_header->ip6_hlim, rtt);
-					inet_ntop(AF_INET6, &source_address.sin6_addr, source_ip, sizeof(source_ip));
-					fprintf(stdout, "%d bytes from %s: icmp_seq=%d time=%.2fms\n", payload_size, source_ip, ntohs(icmp6_header->icmp6_seq), rtt);
-					// Stop after maximum requests
-					if (seq == MAX_REQUESTS)
-						break;
-				}
-				else
-					fprintf(stderr, "Error: packet received with type %d\n", icmp6_header->icmp6_type);
-			}
+			//stop after max request
+			if (seq == MAX_REQUESTS)
+				break;
 			count--;
+			// Sleep between pings if not flood
 			if (!flood)
 			{
 				sleep(SLEEP_TIME);
 			}
 		}
+		if (count_received > 0)// any responses were received
+		{
+			printf("\n%d packets transmitted, %d recieved, time %.2fms\n", count_sent, count_received, total_time);
+			printf("rtt min/avg/max = %.2f/%.2f/%.2fms\n", min_time, max_time, total_time / count_received);
+		}
+		else
+			fprintf(stderr, "No responses received.\n");
 	}
-	if (count_received > 0)// any responses were received
-	{
-		printf("\n%d packets transmitted, %d recieved, time %.2fms\n", count_sent, count_received, total_time);
-		printf("rtt min/avg/max = %.2f/%.2f/%.2fms\n", min_time, max_time, total_time / count_received);
-	}
-	else
-		fprintf(stderr, "No responses received.\n");
+	if (stats_interval >= 0)
+		stats_dump(stderr);
+	if (ring_name != NULL)
+		ring_close(&ring);
+	free(request);
+	free(buffer);
 	close(sock);
-	return 0;
+	return status;
 }
@@ -0,0 +1,683 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <grp.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "config.h"
+#include "packet.h"
+#include "stats.h"
+#include "rto.h"
+
+// Probe daemon. Holds the raw sockets open and runs jobs sent over a Unix stream socket, one request per line:
+//     ping|trace (-r <probes-per-sec>) (-c <count>) <addr>...
+//     cancel <job>
+// For ping the count is echoes per target, for trace probes per hop. Every answer line starts with the job id:
+//     <job> started <targets>
+//     <job> <addr> seq=<n> (ttl=<ttl>) time=<ms>ms     echo reply
+//     <job> <addr> seq=<n> timeout
+//     <job> <addr> hop=<ttl> <router> time=<ms>ms      trace hop, * for a silent one
+//     <job> done sent=<n> received=<n>
+//     <job> error <message>                            the job failed and is dropped
+// Bad requests get "error <message>". All jobs share one loop, where every job with a free token sends one
+// probe per turn in round robin, so a fast job cannot starve a slow one.
+
+#define MODE_PING 0
+#define MODE_TRACE 1
+
+struct client
+{
+    int fd;
+    char in[DAEMON_LINE];
+    size_t in_len;
+    char out[DAEMON_OUTPUT];
+    size_t out_len;
+    int closing; // stopped reading its results, dropped once the loop comes round
+};
+
+struct target
+{
+    const struct family *family;
+    int raw; // index into raws
+    union sockaddr_any addr;
+    struct in6_addr key; // addr as replies quote it
+    char text[INET6_ADDRSTRLEN];
+    int reached; // trace: hop of the destination, past MAX_HOPS until it answers
+    struct rto rto[MAX_HOPS]; // reply timeout, ping uses the first, trace one per hop
+};
+
+// Probe of a job, kept until answered or timed out.
+struct probe
+{
+    uint32_t number; // position in the job, picks the target and the ttl
+    int pending;
+    struct timeval sent;
+    double deadline;
+};
+
+struct job
+{
+    uint32_t id;
+    uint16_t echo_id;
+    struct client *client;
+    int mode;
+    struct target *targets;
+    uint32_t num_targets;
+    uint32_t count;
+    uint32_t total;  // probe numbers in the job
+    uint32_t next;   // next probe number to send
+    double interval; // ms between probes
+    double next_send;
+    uint32_t sent;   // probes sent, the echo seq is the low 16 bits
+    uint32_t oldest; // oldest sent probe that may still be pending
+    uint32_t received;
+    const char *error; // why the job failed, NULL while it runs
+    double deadline; // earliest of the pending probes, 0 if none
+    struct probe window[DAEMON_WINDOW];
+};
+
+// Raw socket of one family, with the ttl last set on it.
+struct raw
+{
+    int fd;
+    const struct family *family;
+    int ttl;
+};
+
+static struct raw raws[2] = {{-1, &family_v4, 0}, {-1, &family_v6, 0}};
+static struct client *clients[DAEMON_MAX_CLIENTS];
+static int num_clients;
+static struct job *jobs[DAEMON_MAX_JOBS];
+static int num_jobs;
+static int cursor; // job to go first in the next round
+static struct job *by_echo_id[65536];
+static uint32_t next_job_id = 1;
+static uint16_t next_echo_id;
+static int rto_min = RTO_MIN, rto_max = RTO_MAX;
+static volatile sig_atomic_t stopping;
+
+static const char *payload = "ABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890!@#$^&*()_+{}|:<>?~`-=[]',.";
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s (-p <socket-path>) (-u <user>) (-S <stats-interval>) (-m <min-timeout-ms>) (-M <max-timeout-ms>)\n"
+                    "probes leave by the routing table, -i is only in discovery\n",
+            name);
+}
+
+static void stop(int sig)
+{
+    (void)sig;
+    stopping = 1;
+}
+
+static double now_ms(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+// Queues a line for the client. A client whose buffer is full stopped reading and is dropped.
+static void client_printf(struct client *client, const char *format, ...)
+{
+    if (client->closing)
+        return;
+    va_list args;
+    va_start(args, format);
+    size_t room = sizeof(client->out) - client->out_len;
+    int len = vsnprintf(client->out + client->out_len, room, format, args);
+    va_end(args);
+    if (len < 0 || (size_t)len >= room)
+    {
+        client->closing = 1;
+        return;
+    }
+    client->out_len += len;
+}
+
+static void job_free(int index)
+{
+    struct job *job = jobs[index];
+    by_echo_id[job->echo_id] = NULL;
+    free(job->targets);
+    free(job);
+    // keep the round robin order
+    memmove(&jobs[index], &jobs[index + 1], (num_jobs - index - 1) * sizeof(*jobs));
+    num_jobs--;
+    if (cursor > index)
+        cursor--;
+}
+
+static void client_close(int index)
+{
+    struct client *client = clients[index];
+    for (int i = num_jobs - 1; i >= 0; i--)
+        if (jobs[i]->client == client)
+            job_free(i);
+    close(client->fd);
+    free(client);
+    clients[index] = clients[--num_clients];
+}
+
+// Parses a request and starts its job.
+static void job_start(struct client *client, char *line)
+{
+    char *save;
+    char *mode = strtok_r(line, " \t\r", &save);
+    if (mode == NULL)
+        return;
+    if (strcmp(mode, "cancel") == 0)
+    {
+        char *arg = strtok_r(NULL, " \t\r", &save);
+        uint32_t id = arg != NULL ? strtoul(arg, NULL, 10) : 0;
+        for (int i = 0; i < num_jobs; i++)
+        {
+            if (jobs[i]->id == id && jobs[i]->client == client)
+            {
+                client_printf(client, "%u done sent=%u received=%u\n", id, jobs[i]->sent, jobs[i]->received);
+                job_free(i);
+                return;
+            }
+        }
+        client_printf(client, "error no job %s\n", arg != NULL ? arg : "");
+        return;
+    }
+    struct job *job = calloc(1, sizeof(*job));
+    if (job == NULL || (job->targets = malloc(DAEMON_MAX_TARGETS * sizeof(*job->targets))) == NULL)
+    {
+        free(job);
+        client_printf(client, "error out of memory\n");
+        return;
+    }
+    const char *error = NULL;
+    double rate = DAEMON_RATE;
+    long count = 1;
+    if (strcmp(mode, "ping") == 0)
+        job->mode = MODE_PING;
+    else if (strcmp(mode, "trace") == 0)
+        job->mode = MODE_TRACE;
+    else
+        error = "unknown mode";
+    for (char *arg; error == NULL && (arg = strtok_r(NULL, " \t\r", &save)) != NULL;)
+    {
+        if (strcmp(arg, "-r") == 0 || strcmp(arg, "-c") == 0)
+        {
+            char *value = strtok_r(NULL, " \t\r", &save);
+            if (value == NULL)
+                error = "missing option value";
+            else if (arg[1] == 'r' && ((rate = atof(value)) <= 0 || rate > DAEMON_MAX_RATE))
+                error = "invalid rate";
+            else if (arg[1] == 'c' && ((count = atol(value)) < 1 || count > DAEMON_MAX_COUNT))
+                error = "invalid count";
+            continue;
+        }
+        if (job->num_targets == DAEMON_MAX_TARGETS)
+        {
+            error = "too many targets";
+            break;
+        }
+        struct target *target = &job->targets[job->num_targets];
+        if ((target->family = family_parse(arg, &target->addr)) == NULL)
+            error = "invalid address";
+        else if (raws[target->raw = target->family == &family_v6].fd < 0)
+            error = "address family not available";
+        else
+        {
+            target->key = target->addr.v6.sin6_addr;
+            if (target->family == &family_v4)
+                addr_map_v4(&target->key, target->addr.v4.sin_addr.s_addr);
+            addr_ntop(&target->key, target->text);
+            target->reached = MAX_HOPS + 1;
+            for (int hop = 0; hop < MAX_HOPS; hop++)
+                rto_init(&target->rto[hop], RTO_INITIAL, rto_min, rto_max);
+            job->num_targets++;
+        }
+    }
+    if (error == NULL && job->num_targets == 0)
+        error = "no targets";
+    if (error == NULL && num_jobs == DAEMON_MAX_JOBS)
+        error = "too many jobs";
+    if (error != NULL)
+    {
+        client_printf(client, "error %s\n", error);
+        free(job->targets);
+        free(job);
+        return;
+    }
+    // every job gets its own echo id, so a reply finds its job in one lookup
+    while (by_echo_id[next_echo_id] != NULL)
+        next_echo_id++;
+    job->echo_id = next_echo_id++;
+    by_echo_id[job->echo_id] = job;
+    job->id = next_job_id++;
+    job->client = client;
+    job->count = count;
+    job->total = job->num_targets * count * (job->mode == MODE_TRACE ? MAX_HOPS : 1);
+    job->interval = 1000.0 / rate;
+    job->next_send = now_ms();
+    jobs[num_jobs++] = job;
+    client_printf(client, "%u started %u\n", job->id, job->num_targets);
+}
+
+// Ttl of a probe number, 0 for the default.
+static int probe_ttl(const struct job *job, uint32_t number)
+{
+    if (job->mode == MODE_PING)
+        return 0;
+    return 1 + number / job->num_targets / job->count;
+}
+
+// Timeout estimator of a probe number, of its target and, for a trace, of its hop.
+static struct rto *probe_rto(const struct job *job, uint32_t number)
+{
+    int ttl = probe_ttl(job, number);
+    return &job->targets[number % job->num_targets].rto[ttl > 0 ? ttl - 1 : 0];
+}
+
+// Sends the next probe of the job if its rate, window and client allow. Returns 1 if it did.
+static int job_send(struct job *job, double now)
+{
+    if (job->error != NULL || job->next_send > now || job->sent - job->oldest >= DAEMON_WINDOW ||
+        job->client->out_len > DAEMON_OUTPUT / 2)
+        return 0;
+    // hops past the destination are not probed
+    while (job->next < job->total &&
+           probe_ttl(job, job->next) > job->targets[job->next % job->num_targets].reached)
+        job->next++;
+    if (job->next >= job->total)
+        return 0;
+    struct target *target = &job->targets[job->next % job->num_targets];
+    struct raw *raw = &raws[target->raw];
+    int ttl = probe_ttl(job, job->next);
+    if (ttl == 0)
+        ttl = DAEMON_TTL;
+    if (raw->ttl != ttl)
+    {
+        // a probe with another ttl would report the wrong hop
+        if (setsockopt(raw->fd, raw->family->ttl_level, raw->family->ttl_option, &ttl, sizeof(ttl)) < 0)
+        {
+            job->error = strerror(errno);
+            return 0;
+        }
+        raw->ttl = ttl;
+    }
+    char buffer[BUFFER_SIZE];
+    int packet_len = family_build_echo(target->family, buffer, job->echo_id, job->sent, payload, strlen(payload) + 1);
+    struct probe *probe = &job->window[job->sent % DAEMON_WINDOW];
+    probe->number = job->next;
+    probe->pending = 1;
+    gettimeofday(&probe->sent, NULL);
+    probe->deadline = now + rto_timeout(probe_rto(job, job->next));
+    if (job->deadline == 0 || probe->deadline < job->deadline)
+        job->deadline = probe->deadline;
+    // a probe the kernel refused is lost like any other and times out
+    stats_sendto(raw->fd, buffer, packet_len, &target->addr.sa, target->family->addr_len);
+    job->sent++;
+    job->next++;
+    // poll wakes up in whole ms, so a job keeps a few ms of tokens but not those of an idle spell
+    if (job->next_send < now - DAEMON_SLACK)
+        job->next_send = now - DAEMON_SLACK;
+    job->next_send += job->interval;
+    return 1;
+}
+
+// Lets every job send one probe per turn, round robin, until none can or the burst is spent.
+static void schedule(double now)
+{
+    int budget = DAEMON_BURST;
+    for (int progress = 1; progress && budget > 0 && num_jobs > 0;)
+    {
+        progress = 0;
+        for (int i = 0; i < num_jobs && budget > 0; i++)
+        {
+            if (job_send(jobs[(cursor + i) % num_jobs], now))
+            {
+                progress = 1;
+                budget--;
+            }
+        }
+        cursor = (cursor + 1) % num_jobs;
+    }
+}
+
+// Reads every pending reply of a raw socket and hands it to its job.
+static void receive(struct raw *raw)
+{
+    char buffer[BUFFER_SIZE];
+    while (1)
+    {
+        union sockaddr_any source_address;
+        int len = stats_recvfrom(raw->fd, buffer, sizeof(buffer), &source_address.sa, &(socklen_t){sizeof(source_address)});
+        if (len <= 0)
+            return;
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        struct reply reply;
+        if (family_parse_reply(raw->family, buffer, len, &source_address.sa, &reply) < 0)
+        {
+            STATS_INC(malformed);
+            continue;
+        }
+        struct job *job = by_echo_id[reply.id];
+        uint32_t age = (uint16_t)(job != NULL ? job->sent - 1 - reply.seq : 0);
+        if (job == NULL || !match_reply(&reply, -1, job->mode == MODE_TRACE ? MATCH_TRACEROUTE : MATCH_PING) ||
+            age >= job->sent - job->oldest)
+        {
+            STATS_INC(filtered[reply.type]);
+            continue;
+        }
+        struct probe *probe = &job->window[(job->sent - 1 - age) % DAEMON_WINDOW];
+        struct target *target = &job->targets[probe->number % job->num_targets];
+        if (!probe->pending || memcmp(&reply.target, &target->key, sizeof(reply.target)) != 0)
+        {
+            STATS_INC(filtered[reply.type]);
+            continue;
+        }
+        probe->pending = 0;
+        job->received++;
+        stats_latency(&probe->sent, &now);
+        double rtt = (now.tv_sec - probe->sent.tv_sec) * 1000.0 + (now.tv_usec - probe->sent.tv_usec) / 1000.0;
+        rto_sample(probe_rto(job, probe->number), rtt);
+        if (job->mode == MODE_PING)
+        {
+            uint32_t seq = probe->number / job->num_targets;
+            if (reply.ttl > 0)
+                client_printf(job->client, "%u %s seq=%u ttl=%d time=%.3fms\n", job->id, target->text, seq, reply.ttl, rtt);
+            else
+                client_printf(job->client, "%u %s seq=%u time=%.3fms\n", job->id, target->text, seq, rtt);
+            continue;
+        }
+        int ttl = probe_ttl(job, probe->number);
+        if (reply.kind == MATCH_ECHO && ttl < target->reached)
+            target->reached = ttl;
+        char router[INET6_ADDRSTRLEN];
+        if (ttl <= target->reached)
+            client_printf(job->client, "%u %s hop=%d %s time=%.3fms\n", job->id, target->text, ttl, addr_ntop(&reply.src, router), rtt);
+    }
+}
+
+// Reports probes whose deadline passed and finishes jobs with nothing left to send or wait for. Every target has its
+// own timeout, so a probe may expire before older ones. The scan stops at the first probe sent too recently to have
+// timed out.
+static void expire(double now)
+{
+    for (int i = num_jobs - 1; i >= 0; i--)
+    {
+        struct job *job = jobs[i];
+        job->deadline = 0;
+        for (uint32_t k = job->oldest; k < job->sent; k++)
+        {
+            struct probe *probe = &job->window[k % DAEMON_WINDOW];
+            if (probe->pending && probe->deadline > now)
+            {
+                if (job->deadline == 0 || probe->deadline < job->deadline)
+                    job->deadline = probe->deadline;
+                double sent = probe->sent.tv_sec * 1000.0 + probe->sent.tv_usec / 1000.0;
+                if (sent + rto_min > now)
+                {
+                    // those sent later time out rto_min after it at the soonest
+                    if (sent + rto_min < job->deadline)
+                        job->deadline = sent + rto_min;
+                    break;
+                }
+                continue;
+            }
+            if (probe->pending)
+            {
+                probe->pending = 0;
+                rto_backoff(probe_rto(job, probe->number));
+                struct target *target = &job->targets[probe->number % job->num_targets];
+                int ttl = probe_ttl(job, probe->number);
+                if (job->mode == MODE_PING)
+                    client_printf(job->client, "%u %s seq=%u timeout\n", job->id, target->text, probe->number / job->num_targets);
+                else if (ttl <= target->reached)
+                    client_printf(job->client, "%u %s hop=%d *\n", job->id, target->text, ttl);
+            }
+            if (k == job->oldest)
+                job->oldest++;
+        }
+        // skip the hops past a destination that was reached meanwhile
+        while (job->next < job->total &&
+               probe_ttl(job, job->next) > job->targets[job->next % job->num_targets].reached)
+            job->next++;
+        if (job->error != NULL)
+        {
+            client_printf(job->client, "%u error cannot set ttl: %s\n", job->id, job->error);
+            job_free(i);
+        }
+        else if (job->next >= job->total && job->oldest == job->sent)
+        {
+            client_printf(job->client, "%u done sent=%u received=%u\n", job->id, job->sent, job->received);
+            job_free(i);
+        }
+    }
+}
+
+// Returns ms until the next probe is due to go out or to time out, at most a second so signals are seen.
+static int next_event(double now)
+{
+    double next = now + 1000;
+    for (int i = 0; i < num_jobs; i++)
+    {
+        struct job *job = jobs[i];
+        if (job->next < job->total && job->sent - job->oldest < DAEMON_WINDOW && job->client->out_len <= DAEMON_OUTPUT / 2 &&
+            job->next_send < next)
+            next = job->next_send;
+        if (job->deadline > 0 && job->deadline < next)
+            next = job->deadline;
+    }
+    return next <= now ? 0 : (int)(next - now) + 1;
+}
+
+// Takes the complete request lines the client sent. Returns -1 once it hung up.
+static int client_read(struct client *client)
+{
+    ssize_t len = recv(client->fd, client->in + client->in_len, sizeof(client->in) - client->in_len, 0);
+    if (len <= 0)
+        return len < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    client->in_len += len;
+    char *start = client->in, *end;
+    while ((end = memchr(start, '\n', client->in + client->in_len - start)) != NULL)
+    {
+        *end = '\0';
+        job_start(client, start);
+        start = end + 1;
+    }
+    client->in_len -= start - client->in;
+    memmove(client->in, start, client->in_len);
+    if (client->in_len == sizeof(client->in))
+    {
+        client_printf(client, "error request too long\n");
+        client->in_len = 0;
+    }
+    return 0;
+}
+
+// Writes out as much of the queued results as the client takes. Returns -1 if it is gone.
+static int client_write(struct client *client)
+{
+    ssize_t len = send(client->fd, client->out, client->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (len < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    client->out_len -= len;
+    memmove(client->out, client->out + len, client->out_len);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    const char *path = DAEMON_SOCKET;
+    const char *user = NULL;
+    int stats_interval = -1;
+    while ((opt = getopt(argc, argv, "p:u:S:m:M:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            path = optarg;
+            break;
+        case 'u':
+            user = optarg;
+            break;
+        case 'S':
+            stats_interval = atoi(optarg);
+            break;
+        case 'm':
+            rto_min = atoi(optarg);
+            break;
+        case 'M':
+            rto_max = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (rto_min <= 0 || rto_max < rto_min)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    // raw sockets are opened once, before privileges are dropped
+    for (int i = 0; i < 2; i++)
+    {
+        raws[i].fd = socket(raws[i].family->domain, SOCK_RAW | SOCK_NONBLOCK, raws[i].family->protocol);
+        if (raws[i].fd >= 0)
+            stats_setup_socket(raws[i].fd, DAEMON_WINDOW, BUFFER_SIZE);
+    }
+    if (raws[0].fd < 0 && raws[1].fd < 0)
+    {
+        perror("socket(2)");
+        if (errno == EACCES || errno == EPERM)
+            fprintf(stderr, "You need to run the program with sudo.\n");
+        return 1;
+    }
+    struct sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(local.sun_path))
+    {
+        fprintf(stderr, "Error: \"%s\" is too long for a socket path\n", path);
+        return 1;
+    }
+    strcpy(local.sun_path, path);
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    // a socket left by a daemon that died is replaced, not a live daemon's nor a path someone else put there
+    struct stat st;
+    if (listener >= 0 && lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode) || st.st_uid != geteuid())
+        {
+            fprintf(stderr, "Error: \"%s\" exists and is not our socket\n", path);
+            return 1;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (probe >= 0 && connect(probe, (struct sockaddr *)&local, sizeof(local)) == 0)
+        {
+            fprintf(stderr, "Error: a daemon already listens on \"%s\"\n", path);
+            return 1;
+        }
+        if (probe >= 0)
+            close(probe);
+        unlink(path);
+    }
+    if (listener < 0 || bind(listener, (struct sockaddr *)&local, sizeof(local)) < 0 || listen(listener, DAEMON_MAX_CLIENTS) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    if (user != NULL)
+    {
+        struct passwd *pw = getpwnam(user);
+        if (pw == NULL || setgroups(0, NULL) < 0 || setgid(pw->pw_gid) < 0 || setuid(pw->pw_uid) < 0)
+        {
+            fprintf(stderr, "Error: cannot switch to user \"%s\"\n", user);
+            unlink(path);
+            return 1;
+        }
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    stats_install(stats_interval);
+    // ids from a random start, pid based ones would meet those of ping and traceroute
+    if (getrandom(&next_echo_id, sizeof(next_echo_id), 0) != sizeof(next_echo_id))
+        next_echo_id = getpid();
+    fprintf(stderr, "listening on %s\n", path);
+    struct pollfd fds[3 + DAEMON_MAX_CLIENTS];
+    while (!stopping)
+    {
+        double now = now_ms();
+        schedule(now);
+        expire(now);
+        // drop clients that stopped reading
+        for (int i = num_clients - 1; i >= 0; i--)
+            if (clients[i]->closing)
+                client_close(i);
+        fds[0] = (struct pollfd){listener, POLLIN, 0};
+        fds[1] = (struct pollfd){raws[0].fd, POLLIN, 0};
+        fds[2] = (struct pollfd){raws[1].fd, POLLIN, 0};
+        for (int i = 0; i < num_clients; i++)
+            fds[3 + i] = (struct pollfd){clients[i]->fd, POLLIN | (clients[i]->out_len > 0 ? POLLOUT : 0), 0};
+        int polled = num_clients;
+        if (stats_poll(fds, 3 + polled, next_event(now)) < 0)
+        {
+            perror("poll(2)");
+            break;
+        }
+        for (int i = 0; i < 2; i++)
+            if (fds[1 + i].revents & POLLIN)
+                receive(&raws[i]);
+        // clients are handled from the back, so closing one does not move those still to come
+        for (int i = polled - 1; i >= 0; i--)
+        {
+            short revents = fds[3 + i].revents;
+            if (((revents & POLLOUT) && client_write(clients[i]) < 0) ||
+                ((revents & (POLLIN | POLLHUP | POLLERR)) && client_read(clients[i]) < 0))
+                client_close(i);
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+            struct client *client = fd >= 0 && num_clients < DAEMON_MAX_CLIENTS ? malloc(sizeof(*client)) : NULL;
+            if (client == NULL)
+            {
+                if (fd >= 0)
+                    close(fd);
+                continue;
+            }
+            client->fd = fd;
+            client->in_len = client->out_len = 0;
+            client->closing = 0;
+            clients[num_clients++] = client;
+        }
+    }
+    while (num_clients > 0)
+        client_close(num_clients - 1);
+    close(listener);
+    unlink(path);
+    for (int i = 0; i < 2; i++)
+        if (raws[i].fd >= 0)
+            close(raws[i].fd);
+    if (stats_interval >= 0)
+        stats_dump(stderr);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/ip6.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "packet.h"
+#include "pcap.h"
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    char *path = NULL;
+    char *mode = "ping";
+    int id = -1;
+    long loops = 1;
+    while ((opt = getopt(argc, argv, "f:m:i:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            path = optarg;
+            break;
+        case 'm':
+            mode = optarg;
+            break;
+        case 'i':
+            id = atoi(optarg);
+            break;
+        case 'l':
+            loops = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s -f <capture> (-m ping|traceroute|discovery) (-i <echo-id>) (-l <loops>)\n", argv[0]);
+            return 1;
+        }
+    }
+    if (path == NULL || loops < 1 || id < -1 || id > 0xffff)
+    {
+        fprintf(stderr, "Usage: %s -f <capture> (-m ping|traceroute|discovery) (-i <echo-id>) (-l <loops>)\n", argv[0]);
+        return 1;
+    }
+    // replies accepted by the selected tool
+    int accept;
+    if (strcmp(mode, "ping") == 0)
+        accept = MATCH_PING;
+    else if (strcmp(mode, "traceroute") == 0)
+        accept = MATCH_TRACEROUTE;
+    else if (strcmp(mode, "discovery") == 0)
+        accept = MATCH_DISCOVERY;
+    else
+    {
+        fprintf(stderr, "Error: \"%s\" is not a valid mode\n", mode);
+        return 1;
+    }
+    struct pcap pcap;
+    if (pcap_open(&pcap, path) < 0)
+        return 1;
+    unsigned long packets = 0, bytes = 0, non_ip = 0, non_icmp = 0, malformed = 0, matched = 0, mismatched = 0;
+    unsigned long mismatched_types[256] = {0};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long l = 0; l < loops; l++)
+    {
+        const unsigned char *packet;
+        int len, ethertype, next;
+        pcap_rewind(&pcap);
+        while ((next = pcap_next(&pcap, &packet, &len, &ethertype)) == 1)
+        {
+            packets++;
+            bytes += len;
+            // same decode and match the tools run on every received packet
+            struct reply reply;
+            int ret;
+            if (ethertype == ETHERTYPE_IP)
+            {
+                if (len >= (int)sizeof(struct iphdr) && ((const struct iphdr *)packet)->protocol != IPPROTO_ICMP)
+                {
+                    non_icmp++;
+                    continue;
+                }
+                ret = parse_reply((const char *)packet, len, NULL, &reply);
+            }
+            else if (ethertype == ETHERTYPE_IPV6)
+            {
+                // raw ICMPv6 sockets hand over the message alone, with the source beside it
+                const struct ip6_hdr *ip6_header = (const struct ip6_hdr *)packet;
+                if (len < (int)sizeof(*ip6_header) || ip6_header->ip6_nxt != IPPROTO_ICMPV6)
+                {
+                    non_icmp++;
+                    continue;
+                }
+                struct sockaddr_in6 from;
+                memset(&from, 0, sizeof(from));
+                from.sin6_family = AF_INET6;
+                from.sin6_addr = ip6_header->ip6_src;
+                ret = parse_reply6((const char *)packet + sizeof(*ip6_header), len - sizeof(*ip6_header), (struct sockaddr *)&from, &reply);
+            }
+            else
+            {
+                non_ip++;
+                continue;
+            }
+            if (ret < 0)
+                malformed++;
+            else if (match_reply(&reply, id, accept))
+                matched++;
+            else
+            {
+                mismatched++;
+                mismatched_types[reply.type]++;
+            }
+        }
+        if (next < 0)
+        {
+            fprintf(stderr, "Error: \"%s\" is corrupt after %lu packets\n", path, packets);
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pcap_close(&pcap);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%lu packets, %lu bytes in %.3fms\n", packets, bytes, elapsed * 1000);
+    if (elapsed > 0)
+        printf("%.2f Mpps, %.2f MB/s\n", packets / elapsed / 1e6, bytes / elapsed / 1e6);
+    printf("matched %lu, mismatched %lu, malformed %lu, non-icmp %lu, non-ip %lu\n",
+           matched, mismatched, malformed, non_icmp, non_ip);
+    for (int type = 0; type < 256; type++)
+        if (mismatched_types[type] > 0)
+            printf("  mismatched type %d: %lu\n", type, mismatched_types[type]);
+    return 0;
+}
@@ -0,0 +1,138 @@
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ring.h"
+
+// Each slot is a seqlock: the producer zeroes seq, writes the sample and then stores its seq, and a reader trusts
+// what it read only if seq was the expected one before and after.
+
+static int ring_map(struct ring *ring, int fd, size_t size, int prot)
+{
+    void *base = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return -1;
+    ring->header = base;
+    ring->slots = (struct sample *)(ring->header + 1);
+    ring->size = size;
+    ring->next = 0;
+    ring->lost = 0;
+    return 0;
+}
+
+int ring_create(struct ring *ring, const char *name, uint32_t slots)
+{
+    uint32_t count = 1;
+    while (count < slots && count < (1u << 30))
+        count <<= 1;
+    size_t size = sizeof(struct ring_header) + (size_t)count * sizeof(struct sample);
+    // a fresh segment, readers of the old one keep their mapping
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, size) < 0 || ring_map(ring, fd, size, PROT_READ | PROT_WRITE) < 0)
+    {
+        perror(name);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    close(fd);
+    ring->header->slots = count;
+    ring->header->producer = getpid();
+    ring->header->version = RING_VERSION;
+    // readers check the magic last
+    __atomic_store_n(&ring->header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void ring_publish(struct ring *ring, const struct sample *sample)
+{
+    uint64_t seq = ring->header->head + 1;
+    struct sample *slot = &ring->slots[seq & (ring->header->slots - 1)];
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)slot + sizeof(slot->seq), (const char *)sample + sizeof(sample->seq), sizeof(*slot) - sizeof(slot->seq));
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->head, seq, __ATOMIC_RELEASE);
+}
+
+int ring_open(struct ring *ring, const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(name);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    int mapped = (size_t)st.st_size >= sizeof(struct ring_header) && ring_map(ring, fd, st.st_size, PROT_READ) == 0;
+    close(fd);
+    if (!mapped)
+    {
+        fprintf(stderr, "Error: %s is not a sample ring\n", name);
+        return -1;
+    }
+    uint32_t slots = ring->header->slots;
+    if (__atomic_load_n(&ring->header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC || ring->header->version != RING_VERSION ||
+        slots == 0 || (slots & (slots - 1)) != 0 || ring->size < sizeof(struct ring_header) + (size_t)slots * sizeof(struct sample))
+    {
+        fprintf(stderr, "Error: %s is not a sample ring\n", name);
+        ring_close(ring);
+        return -1;
+    }
+    uint64_t head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+    ring->next = head >= slots ? head - slots + 1 : 1;
+    return 0;
+}
+
+const struct sample *ring_peek(struct ring *ring)
+{
+    uint32_t slots = ring->header->slots;
+    while (1)
+    {
+        uint64_t head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+        if (ring->next > head)
+            return NULL;
+        // lapped, skip to the oldest sample still in the ring
+        if (head - ring->next >= slots)
+        {
+            ring->lost += head - slots + 1 - ring->next;
+            ring->next = head - slots + 1;
+        }
+        const struct sample *slot = &ring->slots[ring->next & (slots - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == ring->next)
+            return slot;
+        // being overwritten right now
+        ring->lost++;
+        ring->next++;
+    }
+}
+
+int ring_consume(struct ring *ring)
+{
+    const struct sample *slot = &ring->slots[ring->next & (ring->header->slots - 1)];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    int intact = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == ring->next;
+    ring->next++;
+    if (intact)
+        return 0;
+    ring->lost++;
+    return -1;
+}
+
+void ring_close(struct ring *ring)
+{
+    munmap(ring->header, ring->size);
+    ring->header = NULL;
+    ring->slots = NULL;
+}
+
+uint64_t ring_usec(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
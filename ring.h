@@ -0,0 +1,70 @@
+#ifndef _RING_H
+#define _RING_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#define RING_MAGIC 0x52545452 // "RTTR"
+#define RING_VERSION 1
+
+// Outcome of a probe. Same values as the MATCH_ kinds of packet.h, so a reply kind is stored as is.
+#define RING_TIMEOUT 0
+#define RING_REPLY 1
+#define RING_TIME_EXCEEDED 2
+#define RING_UNREACH 4
+
+// One probe, one cache line. Addresses are IPv6, IPv4 as ::ffff:a.b.c.d.
+struct sample
+{
+    uint64_t seq; // position in the ring, counting from 1, 0 while the producer rewrites the slot
+    struct in6_addr target;
+    struct in6_addr from; // who answered, the target or a router on the way, zero on timeout
+    uint64_t sent_us;     // wall clock in microseconds
+    uint64_t received_us; // 0 on timeout
+    uint16_t probe_seq;   // echo seq of the probe
+    uint8_t ttl;          // probe ttl for traceroute, reply ttl for ping, 0 if unknown
+    uint8_t status;
+    uint32_t reserved;
+};
+
+// Start of the segment, the slots follow it.
+struct ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;    // power of two
+    uint32_t producer; // pid
+    uint64_t head;     // seq of the newest published sample
+    char pad[40];
+};
+
+// Mapping of a ring. A producer writes through it, every reader has its own and never writes the segment,
+// so any number of readers run without locks or copies. A reader that falls a ring behind loses the oldest samples.
+struct ring
+{
+    struct ring_header *header;
+    struct sample *slots;
+    size_t size;   // of the mapping
+    uint64_t next; // reader: seq of the next sample to read
+    uint64_t lost; // reader: samples overwritten before they were read
+};
+
+// Creates the shared-memory segment name ("/ping", see shm_open(3)) with room for slots samples, rounded up to a power
+// of two, replacing an older one. Returns 0, or -1 with a message on stderr.
+int ring_create(struct ring *ring, const char *name, uint32_t slots);
+// Publishes a sample, its seq is filled in. Never waits for readers.
+void ring_publish(struct ring *ring, const struct sample *sample);
+// Maps an existing ring read only, positioned at its oldest sample. Returns 0, or -1 with a message on stderr.
+int ring_open(struct ring *ring, const char *name);
+// Returns the next sample in place, NULL if there is none yet. Samples overwritten before they were reached are counted in lost.
+const struct sample *ring_peek(struct ring *ring);
+// Moves past the sample ring_peek returned. Returns 0, or -1 if the producer overwrote it while it was read, so its
+// contents are not to be trusted; it is counted in lost then.
+int ring_consume(struct ring *ring);
+// Unmaps the ring. The segment stays until the next ring_create, so readers can drain it.
+void ring_close(struct ring *ring);
+// Converts a gettimeofday(2) time for the sample times.
+uint64_t ring_usec(const struct timeval *tv);
+#endif
@@ -0,0 +1,71 @@
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "packet.h"
+#include "ring.h"
+
+// Example consumer of a sample ring: prints every sample as it is published, until the producer exits.
+
+#define IDLE_SLEEP_US 1000
+
+static const char *status_name(int status)
+{
+    switch (status)
+    {
+    case RING_REPLY:
+        return "reply";
+    case RING_TIME_EXCEEDED:
+        return "time-exceeded";
+    case RING_UNREACH:
+        return "unreachable";
+    default:
+        return "timeout";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s <ring-name>\n", argv[0]);
+        return 1;
+    }
+    struct ring ring;
+    if (ring_open(&ring, argv[1]) < 0)
+        return 1;
+    pid_t producer = ring.header->producer;
+    while (1)
+    {
+        const struct sample *sample = ring_peek(&ring);
+        if (sample == NULL)
+        {
+            // drained, stop once nobody will publish any more
+            if (kill(producer, 0) < 0 && errno == ESRCH)
+                break;
+            usleep(IDLE_SLEEP_US);
+            continue;
+        }
+        // format in place, then check it was not overwritten meanwhile
+        char target[INET6_ADDRSTRLEN], from[INET6_ADDRSTRLEN];
+        uint64_t seq = sample->seq;
+        int status = sample->status;
+        addr_ntop(&sample->target, target);
+        addr_ntop(&sample->from, from);
+        unsigned probe_seq = sample->probe_seq, ttl = sample->ttl;
+        double rtt = status == RING_TIMEOUT ? 0 : (sample->received_us - sample->sent_us) / 1000.0;
+        if (ring_consume(&ring) < 0)
+            continue;
+        if (status == RING_TIMEOUT)
+            printf("%llu %s seq=%u ttl=%u timeout\n", (unsigned long long)seq, target, probe_seq, ttl);
+        else
+            printf("%llu %s seq=%u ttl=%u %s from %s time=%.3fms\n", (unsigned long long)seq, target, probe_seq, ttl,
+                   status_name(status), from, rtt);
+        fflush(stdout);
+    }
+    fprintf(stderr, "%llu samples lost\n", (unsigned long long)ring.lost);
+    ring_close(&ring);
+    return 0;
+}
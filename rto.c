@@ -0,0 +1,62 @@
+#include "rto.h"
+
+// clock granularity, the variation term never goes below it
+#define RTO_GRANULARITY 1.0
+
+static double clamp(const struct rto *rto, double timeout)
+{
+    if (timeout < rto->min)
+        return rto->min;
+    if (timeout > rto->max)
+        return rto->max;
+    return timeout;
+}
+
+// srtt + 4 rttvar, the variation term at least the clock granularity
+static double learned(const struct rto *rto)
+{
+    double variation = 4 * rto->rttvar > RTO_GRANULARITY ? 4 * rto->rttvar : RTO_GRANULARITY;
+    return clamp(rto, rto->srtt + variation);
+}
+
+void rto_init(struct rto *rto, double initial, double min, double max)
+{
+    rto->srtt = 0;
+    rto->rttvar = 0;
+    rto->min = min;
+    rto->max = max;
+    rto->timeout = clamp(rto, initial);
+}
+
+void rto_sample(struct rto *rto, double rtt)
+{
+    if (rto->srtt == 0)
+    {
+        rto->srtt = rtt;
+        rto->rttvar = rtt / 2;
+    }
+    else
+    {
+        double delta = rto->srtt > rtt ? rto->srtt - rtt : rtt - rto->srtt;
+        rto->rttvar = 0.75 * rto->rttvar + 0.25 * delta;
+        rto->srtt = 0.875 * rto->srtt + 0.125 * rtt;
+    }
+    rto->timeout = learned(rto);
+}
+
+void rto_backoff(struct rto *rto)
+{
+    rto->timeout = clamp(rto, rto->timeout * 2);
+}
+
+void rto_restart(struct rto *rto)
+{
+    if (rto->srtt > 0)
+        rto->timeout = learned(rto);
+}
+
+int rto_timeout(const struct rto *rto)
+{
+    int timeout = (int)rto->timeout;
+    return timeout < rto->timeout ? timeout + 1 : timeout;
+}
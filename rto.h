@@ -0,0 +1,24 @@
+#ifndef _RTO_H
+#define _RTO_H
+
+// Jacobson/Karels retransmission timeout estimator (RFC 6298), in milliseconds.
+struct rto
+{
+    double srtt;   // smoothed rtt, 0 until the first sample
+    double rttvar; // rtt variation
+    double timeout;
+    double min;
+    double max;
+};
+
+// Starts with the initial timeout, clamped to [min, max].
+void rto_init(struct rto *rto, double initial, double min, double max);
+// Feeds an rtt measured on a probe that was not retransmitted (Karn's rule).
+void rto_sample(struct rto *rto, double rtt);
+// Doubles the timeout after a probe went unanswered.
+void rto_backoff(struct rto *rto);
+// Drops the backoff of earlier losses, back to the timeout the samples so far give. Keeps it if there were none.
+void rto_restart(struct rto *rto);
+// Returns the current timeout rounded up to whole milliseconds, for poll(2).
+int rto_timeout(const struct rto *rto);
+#endif
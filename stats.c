@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "stats.h"
+
+// kernel bookkeeping per queued packet on top of its payload
+#define SKB_OVERHEAD 512
+#define RCVBUF_MAX (64 * 1024 * 1024)
+
+static struct stats slots[STATS_MAX_THREADS];
+static int slots_used = 1;
+__thread struct stats *thread_stats = &slots[0];
+// last SO_RXQ_OVFL value seen per socket, the kernel reports a running total for each;
+// sockets past the table share a per-thread value
+static uint32_t last_drops[STATS_MAX_FDS];
+static __thread uint32_t last_drops_other;
+
+static volatile sig_atomic_t dump_requested;
+static int dump_interval;
+static struct timespec last_dump;
+
+void stats_thread_init(void)
+{
+    int slot = __sync_fetch_and_add(&slots_used, 1);
+    // threads past the limit share the last block
+    if (slot >= STATS_MAX_THREADS)
+        slot = STATS_MAX_THREADS - 1;
+    thread_stats = &slots[slot];
+}
+
+static void request_dump(int sig)
+{
+    (void)sig;
+    dump_requested = 1;
+}
+
+void stats_install(int interval)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_dump;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    dump_interval = interval;
+    clock_gettime(CLOCK_MONOTONIC, &last_dump);
+}
+
+void stats_check(void)
+{
+    if (dump_interval > 0)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - last_dump.tv_sec >= dump_interval)
+        {
+            last_dump = now;
+            dump_requested = 1;
+        }
+    }
+    if (dump_requested)
+    {
+        dump_requested = 0;
+        stats_dump(stderr);
+    }
+}
+
+void stats_dump(FILE *out)
+{
+    struct stats total;
+    memset(&total, 0, sizeof(total));
+    int used = slots_used < STATS_MAX_THREADS ? slots_used : STATS_MAX_THREADS;
+    // every field is an unsigned long, so the blocks can be summed as arrays
+    for (int i = 0; i < used; i++)
+    {
+        const unsigned long *from = (const unsigned long *)&slots[i];
+        unsigned long *to = (unsigned long *)&total;
+        for (size_t j = 0; j < sizeof(total) / sizeof(unsigned long); j++)
+            to[j] += from[j];
+    }
+    fprintf(out, "--- stats ---\n");
+    fprintf(out, "sent %lu (eagain %lu, enobufs %lu, errors %lu)\n",
+            total.sent, total.send_eagain, total.send_enobufs, total.send_errors);
+    fprintf(out, "received %lu (malformed %lu, kernel drops %lu)\n",
+            total.received, total.malformed, total.kernel_drops);
+    fprintf(out, "wakeups %lu (idle %lu)\n", total.wakeups, total.idle_wakeups);
+    for (int type = 0; type < 256; type++)
+        if (total.filtered[type] > 0)
+            fprintf(out, "filtered type %d: %lu\n", type, total.filtered[type]);
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        if (total.latency[i] > 0)
+            fprintf(out, "latency < %luus: %lu\n", 1UL << i, total.latency[i]);
+    fflush(out);
+}
+
+void stats_setup_socket(int sock, int burst, int packet_size)
+{
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+    // the descriptor may have been another socket's
+    if (sock >= 0 && sock < STATS_MAX_FDS)
+        __atomic_store_n(&last_drops[sock], 0, __ATOMIC_RELAXED);
+    long want = (long)burst * (packet_size + SKB_OVERHEAD);
+    if (want > RCVBUF_MAX)
+        want = RCVBUF_MAX;
+    int current;
+    socklen_t len = sizeof(current);
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &current, &len) == 0 && current >= want)
+        return;
+    // the kernel doubles the value; only SO_RCVBUFFORCE may exceed rmem_max
+    int size = want / 2;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+ssize_t stats_sendto(int sock, const void *buffer, size_t len, const struct sockaddr *dst, socklen_t dst_len)
+{
+    ssize_t ret = sendto(sock, buffer, len, 0, dst, dst_len);
+    if (ret >= 0)
+        STATS_INC(sent);
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        STATS_INC(send_eagain);
+    else if (errno == ENOBUFS)
+        STATS_INC(send_enobufs);
+    else
+        STATS_INC(send_errors);
+    return ret;
+}
+
+ssize_t stats_recvfrom(int sock, void *buffer, size_t len, struct sockaddr *src, socklen_t *src_len)
+{
+    return stats_recvfrom_if(sock, buffer, len, src, src_len, NULL);
+}
+
+ssize_t stats_recvfrom_if(int sock, void *buffer, size_t len, struct sockaddr *src, socklen_t *src_len, int *ifindex)
+{
+    char control[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct in6_pktinfo))];
+    struct iovec iov = {buffer, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = src;
+    msg.msg_namelen = *src_len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t ret = recvmsg(sock, &msg, 0);
+    if (ret < 0)
+        return ret;
+    *src_len = msg.msg_namelen;
+    STATS_INC(received);
+    if (ifindex != NULL)
+        *ifindex = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            uint32_t last;
+            if (sock >= 0 && sock < STATS_MAX_FDS)
+                last = __atomic_exchange_n(&last_drops[sock], drops, __ATOMIC_RELAXED);
+            else
+            {
+                last = last_drops_other;
+                last_drops_other = drops;
+            }
+            thread_stats->kernel_drops += drops - last;
+        }
+        else if (ifindex != NULL && cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO)
+        {
+            struct in_pktinfo info;
+            memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+            *ifindex = info.ipi_ifindex;
+        }
+        else if (ifindex != NULL && cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO)
+        {
+            struct in6_pktinfo info;
+            memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+            *ifindex = info.ipi6_ifindex;
+        }
+    }
+    return ret;
+}
+
+int stats_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    int ret;
+    // a dump request interrupts poll, print it and keep waiting
+    while ((ret = poll(fds, nfds, timeout)) < 0 && errno == EINTR)
+        stats_check();
+    STATS_INC(wakeups);
+    if (ret == 0)
+        STATS_INC(idle_wakeups);
+    stats_check();
+    return ret;
+}
+
+void stats_latency(const struct timeval *start, const struct timeval *end)
+{
+    long us = (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_usec - start->tv_usec);
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && us >= (1L << bucket))
+        bucket++;
+    STATS_INC(latency[bucket]);
+}
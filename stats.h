@@ -0,0 +1,52 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define STATS_MAX_THREADS 64
+#define STATS_MAX_FDS 1024 // sockets whose kernel drops are told apart
+#define LATENCY_BUCKETS 24 // power of two microsecond buckets, up to ~8s
+
+// Hot-path counters. Each thread owns one block, so updates need no atomics.
+struct stats
+{
+    unsigned long sent;
+    unsigned long send_eagain;
+    unsigned long send_enobufs;
+    unsigned long send_errors;
+    unsigned long received;
+    unsigned long malformed;
+    unsigned long filtered[256]; // replies that did not match our probes, by ICMP type
+    unsigned long kernel_drops;  // socket buffer overflows reported by SO_RXQ_OVFL
+    unsigned long wakeups;
+    unsigned long idle_wakeups; // poll returned with nothing to read
+    unsigned long latency[LATENCY_BUCKETS];
+};
+
+extern __thread struct stats *thread_stats;
+
+#define STATS_INC(field) (thread_stats->field++)
+
+// Gives the calling thread its own counter block. The main thread has one already.
+void stats_thread_init(void);
+// Dumps the counters on SIGUSR1, and every interval seconds if interval > 0.
+void stats_install(int interval);
+// Dumps the counters if a dump is due. Called from the wrappers below.
+void stats_check(void);
+// Prints the counters of all threads, summed.
+void stats_dump(FILE *out);
+// Enables kernel drop reporting and grows SO_RCVBUF to hold burst replies of packet_size bytes.
+void stats_setup_socket(int sock, int burst, int packet_size);
+// sendto(2), recvfrom(2) and poll(2) that keep the counters. EINTR from poll is retried.
+ssize_t stats_sendto(int sock, const void *buffer, size_t len, const struct sockaddr *dst, socklen_t dst_len);
+ssize_t stats_recvfrom(int sock, void *buffer, size_t len, struct sockaddr *src, socklen_t *src_len);
+int stats_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+// stats_recvfrom that also tells the interface the packet came in by, 0 unless IP_PKTINFO or IPV6_RECVPKTINFO is on.
+ssize_t stats_recvfrom_if(int sock, void *buffer, size_t len, struct sockaddr *src, socklen_t *src_len, int *ifindex);
+// Adds a send-to-reply time to the latency histogram.
+void stats_latency(const struct timeval *start, const struct timeval *end);
+#endif
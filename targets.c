@@ -0,0 +1,245 @@
+#define _DEFAULT_SOURCE
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "targets.h"
+
+// longest line we accept, an address range with some spaces around it
+#define LINE_MAX_LEN 128
+
+int ranges_add(struct ranges *ranges, uint64_t first, uint64_t last)
+{
+    if (ranges->count == ranges->capacity)
+    {
+        size_t capacity = ranges->capacity ? ranges->capacity * 2 : 64;
+        struct range *items = realloc(ranges->items, capacity * sizeof(*items));
+        if (items == NULL)
+            return -1;
+        ranges->items = items;
+        ranges->capacity = capacity;
+    }
+    ranges->items[ranges->count].first = first;
+    ranges->items[ranges->count].last = last;
+    ranges->count++;
+    return 0;
+}
+
+// Converts a dotted quad to a host order address. Returns 0 on success, -1 if malformed.
+static int parse_addr(const char *text, uint64_t *addr)
+{
+    struct in_addr in;
+    if (inet_pton(AF_INET, text, &in) != 1)
+        return -1;
+    *addr = ntohl(in.s_addr);
+    return 0;
+}
+
+int ranges_parse(struct ranges *ranges, const char *text, struct ranges *edges)
+{
+    char buffer[LINE_MAX_LEN];
+    if (strlen(text) >= sizeof(buffer))
+        return -1;
+    strcpy(buffer, text);
+    uint64_t first, last;
+    char *sep;
+    if ((sep = strchr(buffer, '/')) != NULL)
+    {
+        *sep = '\0';
+        char *end;
+        long len = strtol(sep + 1, &end, 10);
+        if (*end != '\0' || end == sep + 1 || len < 0 || len > 32 || parse_addr(buffer, &first) < 0)
+            return -1;
+        uint64_t size = (uint64_t)1 << (32 - len);
+        first &= ~(size - 1);
+        last = first + size - 1;
+        if (edges != NULL && len <= 30 && (ranges_add(edges, first, first) < 0 || ranges_add(edges, last, last) < 0))
+            return -1;
+    }
+    else if ((sep = strchr(buffer, '-')) != NULL)
+    {
+        *sep = '\0';
+        if (parse_addr(buffer, &first) < 0 || parse_addr(sep + 1, &last) < 0 || last < first)
+            return -1;
+    }
+    else
+    {
+        if (parse_addr(buffer, &first) < 0)
+            return -1;
+        last = first;
+    }
+    return ranges_add(ranges, first, last);
+}
+
+int ranges_load(struct ranges *ranges, const char *path, struct ranges *edges)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    char line[LINE_MAX_LEN];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_no++;
+        // strip comments and surrounding spaces
+        char *hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+        char *start = line;
+        while (isspace((unsigned char)*start))
+            start++;
+        char *end = start + strlen(start);
+        while (end > start && isspace((unsigned char)end[-1]))
+            *--end = '\0';
+        if (*start == '\0')
+            continue;
+        if (ranges_parse(ranges, start, edges) < 0)
+        {
+            fprintf(stderr, "Error: %s:%d: \"%s\" is not a valid address, prefix or range\n", path, line_no, start);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+static int compare_range(const void *a, const void *b)
+{
+    const struct range *x = a, *y = b;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+void ranges_normalize(struct ranges *ranges)
+{
+    qsort(ranges->items, ranges->count, sizeof(*ranges->items), compare_range);
+    size_t merged = 0;
+    for (size_t i = 0; i < ranges->count; i++)
+    {
+        struct range *range = &ranges->items[i];
+        if (merged > 0 && range->first <= ranges->items[merged - 1].last + 1)
+        {
+            if (range->last > ranges->items[merged - 1].last)
+                ranges->items[merged - 1].last = range->last;
+            continue;
+        }
+        ranges->items[merged++] = *range;
+    }
+    ranges->count = merged;
+    ranges->size = 0;
+    for (size_t i = 0; i < ranges->count; i++)
+    {
+        ranges->items[i].rank = ranges->size;
+        ranges->size += ranges->items[i].last - ranges->items[i].first + 1;
+    }
+}
+
+size_t ranges_lower_bound(const struct ranges *ranges, uint64_t value)
+{
+    size_t low = 0, high = ranges->count;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (ranges->items[mid].last < value)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+int64_t ranges_rank(const struct ranges *ranges, uint64_t addr)
+{
+    size_t i = ranges_lower_bound(ranges, addr);
+    if (i == ranges->count || ranges->items[i].first > addr)
+        return -1;
+    return ranges->items[i].rank + (addr - ranges->items[i].first);
+}
+
+uint64_t ranges_addr(const struct ranges *ranges, uint64_t rank)
+{
+    // find the last run starting at or before rank
+    size_t low = 0, high = ranges->count;
+    while (high - low > 1)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (ranges->items[mid].rank <= rank)
+            low = mid;
+        else
+            high = mid;
+    }
+    return ranges->items[low].first + (rank - ranges->items[low].rank);
+}
+
+int ranges_to_ranks(const struct ranges *targets, const struct ranges *exclude, struct ranges *ranks)
+{
+    size_t t = 0;
+    for (size_t e = 0; e < exclude->count; e++)
+    {
+        const struct range *ex = &exclude->items[e];
+        // both sets are sorted, so walk them together
+        while (t < targets->count && targets->items[t].last < ex->first)
+            t++;
+        for (size_t i = t; i < targets->count && targets->items[i].first <= ex->last; i++)
+        {
+            const struct range *target = &targets->items[i];
+            uint64_t first = ex->first > target->first ? ex->first : target->first;
+            uint64_t last = ex->last < target->last ? ex->last : target->last;
+            if (ranges_add(ranks, target->rank + (first - target->first), target->rank + (last - target->first)) < 0)
+                return -1;
+        }
+    }
+    ranges_normalize(ranks);
+    return 0;
+}
+
+int ranges_subtract(const struct ranges *a, const struct ranges *b, struct ranges *out)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < a->count; i++)
+    {
+        uint64_t next = a->items[i].first, last = a->items[i].last;
+        // the rest of the run is in b. Kept as a flag since next wraps to 0 after a run of b that ends at the top,
+        // and 0 is also where a run of a may start.
+        int covered = 0;
+        while (j < b->count && b->items[j].last < next)
+            j++;
+        // a run of b may cover the end of this run and the start of the next one, so j is not advanced past it
+        for (size_t k = j; k < b->count && b->items[k].first <= last && !covered; k++)
+        {
+            if (b->items[k].first > next && ranges_add(out, next, b->items[k].first - 1) < 0)
+                return -1;
+            covered = b->items[k].last >= last;
+            next = b->items[k].last + 1;
+        }
+        if (!covered && ranges_add(out, next, last) < 0)
+            return -1;
+    }
+    ranges_normalize(out);
+    return 0;
+}
+
+uint64_t ranges_hash_value(uint64_t hash, uint64_t value)
+{
+    for (int i = 0; i < 8; i++, value >>= 8)
+        hash = (hash ^ (value & 0xff)) * 0x100000001b3ULL;
+    return hash;
+}
+
+uint64_t ranges_hash(const struct ranges *ranges, uint64_t hash)
+{
+    for (size_t i = 0; i < ranges->count; i++)
+        hash = ranges_hash_value(ranges_hash_value(hash, ranges->items[i].first), ranges->items[i].last);
+    return hash;
+}
+
+void ranges_free(struct ranges *ranges)
+{
+    free(ranges->items);
+    ranges->items = NULL;
+    ranges->count = ranges->capacity = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef _TARGETS_H
+#define _TARGETS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RANGES_HASH_INIT 0xcbf29ce484222325ULL
+
+// Inclusive run of addresses (host order), or of ranks within a target set.
+struct range
+{
+    uint64_t first;
+    uint64_t last;
+    uint64_t rank; // position of first within the set, filled in by ranges_normalize
+};
+
+// Sorted, merged interval set.
+struct ranges
+{
+    struct range *items;
+    size_t count;
+    size_t capacity;
+    uint64_t size; // addresses covered, valid after ranges_normalize
+};
+
+// Adds a run of addresses. Returns 0 on success, -1 if out of memory.
+int ranges_add(struct ranges *ranges, uint64_t first, uint64_t last);
+// Adds "a.b.c.d", "a.b.c.d/len" or "a.b.c.d-e.f.g.h". The network and broadcast addresses of a prefix of up to
+// /30 are also added to edges unless it is NULL. Returns 0 on success, -1 if malformed or out of memory.
+int ranges_parse(struct ranges *ranges, const char *text, struct ranges *edges);
+// Adds every line of a file, skipping blanks and # comments. Returns 0 on success, -1 with a message otherwise.
+int ranges_load(struct ranges *ranges, const char *path, struct ranges *edges);
+// Sorts and merges overlapping or adjacent runs and numbers the addresses.
+void ranges_normalize(struct ranges *ranges);
+// Returns the index of the first run ending at or after value, or count if there is none. O(log n).
+size_t ranges_lower_bound(const struct ranges *ranges, uint64_t value);
+// Returns the rank of addr within the set, or -1 if it is not in the set.
+int64_t ranges_rank(const struct ranges *ranges, uint64_t addr);
+// Returns the address with the given rank.
+uint64_t ranges_addr(const struct ranges *ranges, uint64_t rank);
+// Fills ranks with the ranks of the addresses of exclude that are in targets. Both must be normalized.
+int ranges_to_ranks(const struct ranges *targets, const struct ranges *exclude, struct ranges *ranks);
+// Folds value into an FNV-1a hash, which starts at RANGES_HASH_INIT.
+uint64_t ranges_hash_value(uint64_t hash, uint64_t value);
+// Folds the runs of a normalized set into hash, so equal sets hash alike.
+uint64_t ranges_hash(const struct ranges *ranges, uint64_t hash);
+// Fills out with the values of a that are not in b. Both must be normalized. Returns 0 on success, -1 if out of memory.
+int ranges_subtract(const struct ranges *a, const struct ranges *b, struct ranges *out);
+void ranges_free(struct ranges *ranges);
+#endif
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "targets.h"
+
+#define MAX_RUNS 4
+#define TOP UINT64_MAX
+
+// Runs of a set, first and last, ended by count.
+struct set
+{
+    int count;
+    uint64_t runs[MAX_RUNS][2];
+};
+
+static int failures;
+
+static void fill(struct ranges *ranges, const struct set *set)
+{
+    memset(ranges, 0, sizeof(*ranges));
+    for (int i = 0; i < set->count; i++)
+        ranges_add(ranges, set->runs[i][0], set->runs[i][1]);
+    ranges_normalize(ranges);
+}
+
+static void expect(const char *name, const struct ranges *got, const struct set *want)
+{
+    int same = got->count == (size_t)want->count;
+    for (int i = 0; same && i < want->count; i++)
+        same = got->items[i].first == want->runs[i][0] && got->items[i].last == want->runs[i][1];
+    if (same)
+        return;
+    failures++;
+    printf("FAIL %s: got", name);
+    for (size_t i = 0; i < got->count; i++)
+        printf(" %llu-%llu", (unsigned long long)got->items[i].first, (unsigned long long)got->items[i].last);
+    printf("\n");
+}
+
+static void test_parse(void)
+{
+    static const struct
+    {
+        const char *text;
+        int ok;
+        struct set runs;
+        struct set edges;
+    } cases[] = {
+        {"10.0.0.1", 1, {1, {{0x0a000001, 0x0a000001}}}, {0, {{0}}}},
+        {"10.0.0.1-10.0.0.9", 1, {1, {{0x0a000001, 0x0a000009}}}, {0, {{0}}}},
+        {"10.0.0.7/30", 1, {1, {{0x0a000004, 0x0a000007}}}, {2, {{0x0a000004, 0x0a000004}, {0x0a000007, 0x0a000007}}}},
+        {"10.0.0.6/31", 1, {1, {{0x0a000006, 0x0a000007}}}, {0, {{0}}}},
+        {"0.0.0.0/0", 1, {1, {{0, 0xffffffff}}}, {2, {{0, 0}, {0xffffffff, 0xffffffff}}}},
+        {"10.0.0.9-10.0.0.1", 0, {0, {{0}}}, {0, {{0}}}},
+        {"10.0.0.0/33", 0, {0, {{0}}}, {0, {{0}}}},
+        {"10.0.0", 0, {0, {{0}}}, {0, {{0}}}},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        struct ranges ranges = {NULL, 0, 0, 0}, edges = {NULL, 0, 0, 0};
+        int ok = ranges_parse(&ranges, cases[i].text, &edges) == 0;
+        ranges_normalize(&ranges);
+        ranges_normalize(&edges);
+        if (ok != cases[i].ok)
+        {
+            failures++;
+            printf("FAIL parse %s: %s\n", cases[i].text, ok ? "accepted" : "rejected");
+        }
+        else if (ok)
+        {
+            expect(cases[i].text, &ranges, &cases[i].runs);
+            expect(cases[i].text, &edges, &cases[i].edges);
+        }
+        ranges_free(&ranges);
+        ranges_free(&edges);
+    }
+}
+
+static void test_normalize(void)
+{
+    static const struct
+    {
+        const char *name;
+        struct set in;
+        struct set out;
+    } cases[] = {
+        {"overlap", {2, {{10, 20}, {15, 30}}}, {1, {{10, 30}}}},
+        {"adjacent", {2, {{21, 30}, {10, 20}}}, {1, {{10, 30}}}},
+        {"gap", {2, {{10, 20}, {22, 30}}}, {2, {{10, 20}, {22, 30}}}},
+        {"inside", {2, {{10, 40}, {15, 20}}}, {1, {{10, 40}}}},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        struct ranges ranges;
+        fill(&ranges, &cases[i].in);
+        expect(cases[i].name, &ranges, &cases[i].out);
+        ranges_free(&ranges);
+    }
+}
+
+static void test_subtract(void)
+{
+    static const struct
+    {
+        const char *name;
+        struct set a;
+        struct set b;
+        struct set out;
+    } cases[] = {
+        {"nothing", {1, {{0, 10}}}, {0, {{0}}}, {1, {{0, 10}}}},
+        {"overlap end", {1, {{0, 10}}}, {1, {{5, 20}}}, {1, {{0, 4}}}},
+        {"overlap start", {1, {{10, 20}}}, {1, {{0, 14}}}, {1, {{15, 20}}}},
+        {"adjacent", {1, {{10, 20}}}, {2, {{0, 9}, {21, 30}}}, {1, {{10, 20}}}},
+        {"full cover", {1, {{10, 20}}}, {1, {{0, 30}}}, {0, {{0}}}},
+        {"exact cover", {2, {{0, 5}, {10, 20}}}, {1, {{10, 20}}}, {1, {{0, 5}}}},
+        {"holes", {1, {{0, 100}}}, {2, {{10, 20}, {30, 40}}}, {3, {{0, 9}, {21, 29}, {41, 100}}}},
+        {"across runs", {2, {{0, 5}, {10, 15}}}, {1, {{3, 12}}}, {2, {{0, 2}, {13, 15}}}},
+        {"to the top", {1, {{5, TOP}}}, {1, {{10, TOP}}}, {1, {{5, 9}}}},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        struct ranges a, b, out = {NULL, 0, 0, 0};
+        fill(&a, &cases[i].a);
+        fill(&b, &cases[i].b);
+        if (ranges_subtract(&a, &b, &out) < 0)
+        {
+            failures++;
+            printf("FAIL %s: out of memory\n", cases[i].name);
+        }
+        else
+            expect(cases[i].name, &out, &cases[i].out);
+        ranges_free(&a);
+        ranges_free(&b);
+        ranges_free(&out);
+    }
+}
+
+static void test_rank(void)
+{
+    static const struct set set = {2, {{10, 19}, {30, 39}}};
+    static const struct
+    {
+        uint64_t addr;
+        int64_t rank;
+    } cases[] = {{10, 0}, {19, 9}, {30, 10}, {39, 19}, {9, -1}, {25, -1}, {40, -1}};
+    struct ranges ranges;
+    fill(&ranges, &set);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        int64_t rank = ranges_rank(&ranges, cases[i].addr);
+        if (rank != cases[i].rank || (rank >= 0 && ranges_addr(&ranges, rank) != cases[i].addr))
+        {
+            failures++;
+            printf("FAIL rank of %llu: %lld\n", (unsigned long long)cases[i].addr, (long long)rank);
+        }
+    }
+    ranges_free(&ranges);
+}
+
+int main(void)
+{
+    test_parse();
+    test_normalize();
+    test_subtract();
+    test_rank();
+    printf("%s\n", failures == 0 ? "targets: ok" : "targets: failed");
+    return failures != 0;
+}
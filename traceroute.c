@@ -10,37 +10,60 @@
 #include <sys/time.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <stdlib.h>
 #include "config.h"
+#include "packet.h"
+#include "stats.h"
+#include "rto.h"
+#include "ring.h"
 
 int main(int argc, char *argv[])
 {
     int opt;
     char *dest_addr = NULL;
+    int stats_interval = -1;
+    int rto_min = RTO_MIN, rto_max = RTO_MAX;
+    char *ring_name = NULL;
     // find address
-    while ((opt = getopt(argc, argv, "a:")) >= 0)
+    while ((opt = getopt(argc, argv, "a:S:m:M:R:")) >= 0)
     {
         switch (opt)
         {
         case 'a':
             dest_addr = optarg;
             break;
+        case 'S':
+            stats_interval = atoi(optarg);
+            break;
+        case 'm':
+            rto_min = atoi(optarg);
+            break;
+        case 'M':
+            rto_max = atoi(optarg);
+            break;
+        case 'R':
+            ring_name = optarg;
+            break;
         default:
-            fprintf(stderr, "Usage: %s -a <dest-addr>\n", argv[0]);
+            fprintf(stderr, "Usage: %s -a <dest-addr> (-S <stats-interval>) (-m <min-timeout-ms>) (-M <max-timeout-ms>) (-R <ring-name>)\n"
+                            "probes leave by the routing table, -i is only in discovery\n",
+                    argv[0]);
             return 1;
         }
     }
-    if (dest_addr == NULL)
+    if (dest_addr == NULL || rto_min <= 0 || rto_max < rto_min)
     {
-        fprintf(stderr, "Usage: %s -a <dest-addr>\n", argv[0]);
+        fprintf(stderr, "Usage: %s -a <dest-addr> (-S <stats-interval>) (-m <min-timeout-ms>) (-M <max-timeout-ms>) (-R <ring-name>)\n"
+                        "probes leave by the routing table, -i is only in discovery\n",
+                argv[0]);
         return 1;
     }
-    // set up dest addr
-    struct sockaddr_in destination_address;
-    memset(&destination_address, 0, sizeof(destination_address));
-    destination_address.sin_family = AF_INET;
-    if (inet_pton(AF_INET, dest_addr, &destination_address.sin_addr) <= 0)
+    // set up dest addr, its family picks the packet format and the ttl option
+    union sockaddr_any destination_address;
+    const struct family *family = family_parse(dest_addr, &destination_address);
+    if (family == NULL)
     {
-        fprintf(stderr, "Error: \"%s\" is not a valid IPv4 address\n", argv[1]);
+        fprintf(stderr, "Error: \"%s\" is not a valid IPv4 or IPv6 address\n", dest_addr);
         return 1;
     }
     // set msg
@@ -48,7 +71,7 @@ int main(int argc, char *argv[])
     char *msg = "ABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890!@#$^&*()_+{}|:<>?~`-=[]',.";
     int payload_size = strlen(msg) + 1;
     // create socket
-    int sock = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+    int sock = socket(family->domain, SOCK_RAW, family->protocol);
     if (sock < 0)
     {
         perror("socket(2)");
@@ -56,11 +79,11 @@ int main(int argc, char *argv[])
             fprintf(stderr, "You need to run the program with sudo.\n");
         return 1;
     }
-    // create ICMP header
-    struct icmphdr icmp_header;
-    icmp_header.type = ICMP_ECHO;
-    icmp_header.code = 0;
-    icmp_header.un.echo.id = htons(getpid());
+    // late replies from every hop may queue up
+    stats_setup_socket(sock, 3 * MAX_HOPS, BUFFER_SIZE);
+    stats_install(stats_interval);
+    // echo id
+    uint16_t id = getpid();
     // packet seq
     int seq = 0;
     // no of hops
@@ -69,6 +92,22 @@ int main(int argc, char *argv[])
     int ttl = 1;
     // if reached dest
     int reached_dest = 0;
+    // reply timeout, learned from earlier hops. Each probe that times out doubles it, each new hop starts again from
+    // what the replies so far taught.
+    struct rto rto;
+    rto_init(&rto, RTO_INITIAL, rto_min, rto_max);
+    // every probe is published here for collectors
+    struct ring ring;
+    if (ring_name != NULL && ring_create(&ring, ring_name, RING_SLOTS) < 0)
+    {
+        close(sock);
+        return 1;
+    }
+    struct in6_addr target;
+    if (family == &family_v4)
+        addr_map_v4(&target, destination_address.v4.sin_addr.s_addr);
+    else
+        target = destination_address.v6.sin6_addr;
     // create poll structure
     struct pollfd fds[1];
     fds[0].fd = sock;
@@ -78,80 +117,126 @@ int main(int argc, char *argv[])
     {
         // print hop num
         printf("%d ", hops);
-        // set buff and icmp header
-        memset(buffer, 0, sizeof(buffer));
-        icmp_header.un.echo.sequence = htons(seq++);
-        icmp_header.checksum = 0;
-        // set TTL
-        if (setsockopt(sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) < 0)
+        // set TTL, the hop limit for IPv6
+        if (setsockopt(sock, family->ttl_level, family->ttl_option, &ttl, sizeof(ttl)) < 0)
         {
-            perror("getsockopt(2)");
+            perror("setsockopt(2)");
             close(sock);
             return 1;
         }
-        // add icmp header
-        memcpy(buffer, &icmp_header, sizeof(icmp_header));
-        // add payload after
-        memcpy(buffer + sizeof(icmp_header), msg, payload_size);
-        // calculate checksum
-        int checksum = calculate_checksum(buffer, sizeof(icmp_header) + payload_size);
-        icmp_header.checksum = checksum;
-        struct icmphdr *pckt_hdr = (struct icmphdr *)buffer;
-        pckt_hdr->checksum = icmp_header.checksum;
-        // initialize source address
-        struct sockaddr_in source_address;
-        for (size_t i = 0; i < 3; i++)
+        rto_restart(&rto);
+        // the probes of the hop, a reply that comes in after its probe timed out is still credited to it
+        struct timeval starts[TRACE_PROBES], ends[TRACE_PROBES];
+        struct in6_addr routers[TRACE_PROBES];
+        int kinds[TRACE_PROBES]; // reply kind, RING_TIMEOUT, or -1 if the probe was not sent
+        double rtts[TRACE_PROBES];
+        uint16_t first_seq = seq;
+        for (int i = 0; i < TRACE_PROBES; i++)
         {
-            struct timeval start, end;
+            // build echo request, every probe gets its own seq so late replies can be told apart
+            int packet_len = family_build_echo(family, buffer, id, seq++, msg, payload_size);
+            kinds[i] = RING_TIMEOUT;
             // get start time
-            gettimeofday(&start, NULL);
+            gettimeofday(&starts[i], NULL);
             // send packet
-            if (sendto(sock, buffer, (sizeof(icmp_header) + payload_size), 0, (struct sockaddr *)&destination_address, sizeof(destination_address)) <= 0)
-            {
-                perror("sendto(2)");
-                close(sock);
-                return 1;
-            }
-            // wait for reply
-            int ret = poll(fds, 1, 1000);
-            if (ret == 0)
+            if (stats_sendto(sock, buffer, packet_len, &destination_address.sa, family->addr_len) <= 0)
             {
-                // print asterisk if timeout
-                printf(" * ");
+                if (errno != EAGAIN && errno != ENOBUFS)
+                {
+                    perror("sendto(2)");
+                    close(sock);
+                    return 1;
+                }
+                kinds[i] = -1;
                 continue;
             }
-            else if (ret < 0)
-            {
-                perror("poll(2)");
-                close(sock);
-                return 1;
-            }
-            if (fds[0].revents & POLLIN)
+            // wait for reply until the timeout runs out
+            int timeout = rto_timeout(&rto);
+            while (kinds[i] == RING_TIMEOUT)
             {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                int remaining = timeout - ((now.tv_sec - starts[i].tv_sec) * 1000 + (now.tv_usec - starts[i].tv_usec) / 1000);
+                if (remaining <= 0)
+                    break;
+                int ret = stats_poll(fds, 1, remaining);
+                if (ret == 0)
+                    break;
+                else if (ret < 0)
+                {
+                    perror("poll(2)");
+                    close(sock);
+                    return 1;
+                }
+                if (!(fds[0].revents & POLLIN))
+                    continue;
                 // get source
+                union sockaddr_any source_address;
                 memset(&source_address, 0, sizeof(source_address));
-                memset(buffer, 0, sizeof(buffer));
-                if (recvfrom(sock, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_address, &(socklen_t){sizeof(source_address)}) <= 0)
+                char reply_buffer[BUFFER_SIZE];
+                int len = stats_recvfrom(sock, reply_buffer, sizeof(reply_buffer), &source_address.sa, &(socklen_t){sizeof(source_address)});
+                if (len <= 0)
                 {
                     perror("recvfrom(2)");
                     close(sock);
                     return 1;
                 }
                 // get end time
-                gettimeofday(&end, NULL);
-                // print source address
-                if (i == 0)
-                    printf("%s ", inet_ntoa(source_address.sin_addr));
-                struct iphdr *ip_header = (struct iphdr *)buffer;
-                struct icmphdr *icmp_header = (struct icmphdr *)(buffer + ip_header->ihl * 4);
-                // print elapsed time
-                if (icmp_header->type == ICMP_ECHOREPLY || icmp_header->type == ICMP_TIME_EXCEEDED)
-                    printf("%.3fms ", ((float)(end.tv_usec - start.tv_usec) / 1000) + ((end.tv_sec - start.tv_sec) * 1000));
-                if (icmp_header->type == ICMP_ECHOREPLY)
+                gettimeofday(&now, NULL);
+                struct reply reply;
+                if (family_parse_reply(family, reply_buffer, len, &source_address.sa, &reply) < 0)
+                {
+                    STATS_INC(malformed);
+                    continue;
+                }
+                // any probe of this hop sent so far may be answered
+                int probe = (uint16_t)(reply.seq - first_seq);
+                if (!match_reply(&reply, id, MATCH_TRACEROUTE) || probe > i || kinds[probe] != RING_TIMEOUT)
+                {
+                    STATS_INC(filtered[reply.type]);
+                    continue;
+                }
+                kinds[probe] = reply.kind;
+                routers[probe] = reply.src;
+                ends[probe] = now;
+                stats_latency(&starts[probe], &now);
+                rtts[probe] = (now.tv_sec - starts[probe].tv_sec) * 1000.0 + (now.tv_usec - starts[probe].tv_usec) / 1000.0;
+                rto_sample(&rto, rtts[probe]);
+                if (reply.kind == MATCH_ECHO)
                     reached_dest = 1;
             }
+            if (kinds[i] == RING_TIMEOUT)
+                rto_backoff(&rto);
+        }
+        // print the router once, then the time of every probe, an asterisk if it timed out
+        int printed_addr = 0;
+        for (int i = 0; i < TRACE_PROBES; i++)
+        {
+            if (kinds[i] < 0)
+            {
+                printf(" ! ");
+                continue;
+            }
+            if (kinds[i] == RING_TIMEOUT)
+                printf(" * ");
             else
-                fprintf(stderr, "Error: packet received with type %d\n", icmp_header.type);
+            {
+                char source_ip[INET6_ADDRSTRLEN];
+                if (!printed_addr)
+                    printf("%s ", addr_ntop(&routers[i], source_ip));
+                printed_addr = 1;
+                printf("%.3fms ", rtts[i]);
+            }
+            if (ring_name != NULL)
+            {
+                struct sample sample = {0, target, IN6ADDR_ANY_INIT, ring_usec(&starts[i]), 0, (uint16_t)(first_seq + i), ttl, kinds[i], 0};
+                if (kinds[i] != RING_TIMEOUT)
+                {
+                    sample.from = routers[i];
+                    sample.received_us = ring_usec(&ends[i]);
+                }
+                ring_publish(&ring, &sample);
+            }
         }
         printf("\n");
         // end condition
@@ -161,6 +246,10 @@ int main(int argc, char *argv[])
         ttl++;
         hops++;
     }
+    if (stats_interval >= 0)
+        stats_dump(stderr);
+    if (ring_name != NULL)
+        ring_close(&ring);
     close(sock);
     return 0;
 }
\ No newline at end of file